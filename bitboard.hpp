@@ -0,0 +1,163 @@
+#pragma once
+
+#include "common.hpp"
+
+// Board representation from magic.c for fast random playouts.
+// Every cell sets one bit in the nibble of each of its lines, so a line
+// with three cells overflows into the high bit of its nibble.
+#define HAS_WON(fields) (((fields) + 0x11111111) & 0x88888888)
+#define ALL_MOVES ((1 << 9) - 1)
+
+const u32 move_masks[9] = {
+    1074004032, 536887296, 268436484,
+    67239936, 33562658, 16777728,
+    4259841, 2101248, 1048848,
+};
+
+// set of cells of the macro board
+struct CellSet {
+    Array<u64, 2> bits;
+
+    CellSet(): bits{0, 0}{}
+
+    void insert(u8 big_move, u8 small_move){
+        u8 i = big_move*9 + small_move;
+        bits[i >> 6] |= u64(1) << (i & 63);
+    }
+
+    bool contains(Move move) const {
+        u8 i = move.big_move*9 + move.small_move;
+        return (bits[i >> 6] >> (i & 63)) & 1;
+    }
+};
+
+struct BitBoard;
+struct Tablebase;
+// defined in tablebase.hpp, which programs that pass a tablebase to
+// playout have to include
+bool probe(const BitBoard &bit_board, const Tablebase &tablebase, u8 player, u8 &winner);
+
+struct BitBoard {
+    Array<u32, 9> micro_moves;            // free cells of each micro board
+    Array<Array<u32, 9>, 2> micro_boards; // lines of each player
+    Array<Array<u16, 9>, 2> cells;        // cells of each player
+    u32 macro_moves;                      // micro boards which are not decided yet
+    Array<u32, 2> macro_boards;
+    u8 forced_big_move;                   // 9 if any micro board can be played
+
+    BitBoard(const MacroBoard &macro_board):
+        macro_moves(ALL_MOVES),
+        macro_boards{0, 0},
+        forced_big_move(macro_board.can_play_anywhere() ? 9 : macro_board.moves.back().small_move)
+    {
+        for (u8 big_move = 0; big_move < 9; big_move++){
+            const MicroBoard &micro_board = macro_board.micro_boards[big_move];
+            micro_moves[big_move] = ALL_MOVES;
+            micro_boards[0][big_move] = 0;
+            micro_boards[1][big_move] = 0;
+            cells[0][big_move] = 0;
+            cells[1][big_move] = 0;
+            for (u8 small_move = 0; small_move < 9; small_move++){
+                u8 player = micro_board.get(small_move);
+                if (player == NONE) continue;
+                micro_moves[big_move] &= ~(1 << small_move);
+                micro_boards[player - 1][big_move] |= move_masks[small_move];
+                cells[player - 1][big_move] |= 1 << small_move;
+            }
+
+            u8 winner = macro_board.winners.get(big_move);
+            if (winner == NONE) continue;
+            macro_moves &= ~(1 << big_move);
+            if (winner != TIE) macro_boards[winner - 1] |= move_masks[big_move];
+        }
+    }
+
+    bool can_play_anywhere() const {
+        return forced_big_move == 9 || !((macro_moves >> forced_big_move) & 1);
+    }
+
+    u8 play(u8 big_move, u8 small_move, u8 player){
+        assert((macro_moves >> big_move) & 1);
+        assert((micro_moves[big_move] >> small_move) & 1);
+
+        u32 &micro_board = micro_boards[player - 1][big_move];
+        micro_board |= move_masks[small_move];
+        cells[player - 1][big_move] |= 1 << small_move;
+        micro_moves[big_move] &= ~(1 << small_move);
+        forced_big_move = small_move;
+
+        if (HAS_WON(micro_board)){
+            macro_moves &= ~(1 << big_move);
+            macro_boards[player - 1] |= move_masks[big_move];
+            if (HAS_WON(macro_boards[player - 1])) return player;
+        }else if (!micro_moves[big_move]){
+            macro_moves &= ~(1 << big_move);
+        }
+
+        return macro_moves ? NONE : TIE;
+    }
+
+    static u8 get_random_bit(u32 moves, Rng &rng){
+        while (true){
+            u8 i = rng() % 9;
+            if ((moves >> i) & 1) return i;
+        }
+    }
+
+    // uniformly random bit of non-empty mask
+    static u8 get_random_set_bit(u32 mask, Rng &rng){
+        u32 n = __builtin_popcount(mask);
+        for (u32 i = rng() % n; i > 0; i--) mask &= mask - 1;
+        return __builtin_ctz(mask);
+    }
+
+    // Random move with simple tactics, each rule is one table lookup:
+    // win a micro board if possible, otherwise stop the opponent from
+    // winning it, otherwise do not let the opponent play anywhere.
+    void get_heavy_move(u8 player, Rng &rng, u8 &big_move, u8 &small_move){
+        if (can_play_anywhere()){
+            u32 winnable = 0;
+            for (u32 boards = macro_moves; boards; boards &= boards - 1){
+                u8 i = __builtin_ctz(boards);
+                if (winning_cells[cells[player - 1][i]] & micro_moves[i]) winnable |= 1 << i;
+            }
+            big_move = get_random_set_bit(winnable ? winnable : macro_moves, rng);
+        }else{
+            big_move = forced_big_move;
+        }
+
+        u32 free = micro_moves[big_move];
+        u32 wins = winning_cells[cells[player - 1][big_move]] & free;
+        u32 blocks = winning_cells[cells[2 - player][big_move]] & free;
+        // cells which send the opponent to an undecided micro board
+        u32 safe = free & macro_moves;
+
+        if (wins) free = wins;
+        else if (blocks) free = blocks;
+        else if (safe) free = safe;
+
+        small_move = get_random_set_bit(free, rng);
+    }
+
+    // Play random moves until the game is over and return the winner.
+    // If played is given, the cells played by player 1 and 2 are added
+    // to played[0] and played[1]. If tablebase is given, the playout stops
+    // at the first position in it with the result of perfect play.
+    u8 playout(u8 player, Rng &rng, Array<CellSet, 2> *played = NULL, bool heavy = false, const Tablebase *tablebase = NULL){
+        while (true){
+            u8 winner;
+            if (tablebase && probe(*this, *tablebase, player, winner)) return winner;
+            u8 big_move, small_move;
+            if (heavy){
+                get_heavy_move(player, rng, big_move, small_move);
+            }else{
+                big_move = can_play_anywhere() ? get_random_bit(macro_moves, rng) : forced_big_move;
+                small_move = get_random_bit(micro_moves[big_move], rng);
+            }
+            if (played) (*played)[player - 1].insert(big_move, small_move);
+            winner = play(big_move, small_move, player);
+            if (winner != NONE) return winner;
+            player = NEXT_PLAYER(player);
+        }
+    }
+};
@@ -0,0 +1,1150 @@
+#pragma once
+
+#include <mutex>
+#include <string.h>
+
+#include "util.hpp"
+#include "nnue.hpp"
+
+
+#define NONE 0
+#define TIE  3
+#define MAX_SCORE (1000*1000)
+#define MAX_MOVES (3*3*3*3)
+#define NEXT_PLAYER(player) (player ^ 3) // 0b01 <-> 0b10
+#define USE_HEURISTIC_LOOKUP_TABLE
+#define USE_WINNER_LOOOKUP_TABLE
+// Adds the weighted sum of micro board potentials to the leaf score. Off
+// until it wins a match against the default evaluation at equal time, it
+// is slower per leaf. The 9 boards are combined by the weights of their
+// positions: a table over the joint potentials of 9 boards would have more
+// entries than fit in memory.
+// #define USE_POTENTIAL_EVAL
+#define POTENTIAL_WIN_SCALE 8 // weight of decided micro boards against potentials
+// more reliable per ply than USE_POTENTIAL_EVAL, but slower per node
+// #define USE_PROBABILITY_EVAL
+#define MICRO_BOARD_PLAYOUTS 256 // random games per micro board state
+#define PROBABILITY_SCORE 1000   // score of a certain win
+// Probes MacroAlphaBeta::tablebase at every node below the root. Off since
+// a probe costs more than the few nodes it saves, the program then has to
+// include tablebase.hpp.
+// #define USE_TABLEBASE_PROBE
+
+struct Move {
+    u8 big_move;
+    u8 small_move;
+};
+
+// big move of a last move of which only the small move is known
+#define UNKNOWN_BIG_MOVE 66
+
+typedef SmallVector<Move, MAX_MOVES> Moves;
+typedef Array<u8, 3> ThreeMoves;
+typedef Array<u8, 9> NineMoves;
+typedef Array<int, 9> Weights;
+
+Weights default_weights{
+    3, 2, 3,
+    2, 4, 2,
+    3, 2, 3,
+};
+
+NineMoves default_move_order{4, 1, 3, 5, 7, 0, 2, 6, 8};
+
+constexpr Array<ThreeMoves, 3 + 3 + 2> wins = {
+    ThreeMoves{0, 1, 2}, // 0
+    ThreeMoves{3, 4, 5}, // 1
+    ThreeMoves{6, 7, 8}, // 2
+
+    ThreeMoves{0, 3, 6}, // 3
+    ThreeMoves{1, 4, 7}, // 4
+    ThreeMoves{2, 5, 8}, // 5
+
+    ThreeMoves{0, 4, 8}, // 6
+    ThreeMoves{2, 4, 6}, // 7
+};
+
+// The 8 symmetries of the square as permutations of the cells of a 3x3
+// board. A symmetry of the macro board moves the micro boards and the
+// cells inside them the same way.
+#define N_SYMMETRIES 8
+
+constexpr Array<NineMoves, N_SYMMETRIES> symmetries = {
+    NineMoves{0, 1, 2, 3, 4, 5, 6, 7, 8}, // identity
+    NineMoves{2, 1, 0, 5, 4, 3, 8, 7, 6}, // mirror left and right
+    NineMoves{2, 5, 8, 1, 4, 7, 0, 3, 6}, // rotate clockwise
+    NineMoves{0, 3, 6, 1, 4, 7, 2, 5, 8}, // mirror at main diagonal
+    NineMoves{8, 7, 6, 5, 4, 3, 2, 1, 0}, // rotate half a turn
+    NineMoves{6, 7, 8, 3, 4, 5, 0, 1, 2}, // mirror top and bottom
+    NineMoves{6, 3, 0, 7, 4, 1, 8, 5, 2}, // rotate counterclockwise
+    NineMoves{8, 5, 2, 7, 4, 1, 6, 3, 0}, // mirror at anti-diagonal
+};
+
+// Micro board tables are indexed by the cells as a ternary number,
+// so only valid states take up space.
+#define N_MICRO_BOARDS 19683 // 3^9
+
+const u16 powers_of_three[9] = {1, 3, 9, 27, 81, 243, 729, 2187, 6561};
+
+// A micro board is an automaton over its ternary index: playing a cell adds
+// player*3^cell to the index and one lookup in micro_board_states gives the
+// winner, the free cells, the cells which would win for each player and
+// whether each player has taken or can still take the board.
+#define STATE_FREE_CELLS(state) ((state) & 511)
+#define STATE_WINNER(state) (((state) >> 9) & 3)
+#define STATE_WINNING_CELLS(state, player) (((state) >> (2 + 9*(player))) & 511)
+#define STATE_CAN_TAKE(state, player) (((state) >> (28 + (player))) & 1)
+
+#ifdef GENERATE_TABLES
+u32 micro_board_states[N_MICRO_BOARDS];
+i16 micro_board_score[N_MICRO_BOARDS];
+// chances of X minus chances of O to still win an undecided micro board
+i8 micro_board_potential[N_MICRO_BOARDS];
+// cells which complete a line, indexed by the 9 bit set of cells of a player
+u16 winning_cells[1 << 9];
+// whether a 9 bit set of cells contains a complete line
+bool contains_line[1 << 9];
+// index of every micro board state after applying each symmetry
+u16 micro_board_symmetries[N_SYMMETRIES][N_MICRO_BOARDS];
+#else
+// Generated by gen_tables.cpp into read-only data, so a process only has
+// to page them in instead of computing them before its first move.
+#include "tables.hpp"
+#endif
+
+#ifdef USE_PROBABILITY_EVAL
+// probabilities that X and O take a micro board,
+// indexed by player to move and micro board state
+Array<float, 2> micro_board_probabilities[2][N_MICRO_BOARDS];
+#endif
+
+// random keys to hash positions
+Array<Array<Array<u64, 3>, 9>, 9> zobrist_cells; // [big_move][small_move][player]
+Array<u64, 10> zobrist_forced;                   // forced big move or 9 for any
+u64 zobrist_player;                              // if player 2 is to move
+
+template <typename BOARD>
+bool is_winner(const BOARD &board, u8 player, ThreeMoves moves){
+    for (u8 move : moves){
+        if (board.get(move) != player){
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename BOARD>
+bool is_winner(const BOARD &board, u8 player){
+    for (ThreeMoves moves : wins){
+        if (is_winner(board, player, moves)){
+            return true;
+        }
+    }
+    return false;
+}
+
+struct MicroBoard {
+    u32 fields;
+    u16 index; // ternary digit per cell, ties of the winners board count as empty
+    u8 n_moves;
+
+    MicroBoard(): fields(0), index(0), n_moves(9){
+        for (u8 move = 0; move < 9; move++){
+            unsafe_set(move, NONE);
+        }
+    }
+
+    static MicroBoard from_index(u16 index){
+        MicroBoard micro_board;
+        for (u8 move = 0; move < 9; move++){
+            micro_board.unsafe_set(move, index % 3);
+            index /= 3;
+        }
+        return micro_board;
+    }
+
+    static u8 get_digit(u8 player){
+        return player == TIE ? NONE : player;
+    }
+
+    void unsafe_set(u8 move, u8 player){
+        fields |= player << move*2;
+        index += get_digit(player)*powers_of_three[move];
+    }
+
+    u8 get(u8 move) const {
+        return (fields >> move*2) & 3;
+    }
+
+    void clr(u8 move){
+        assert(get(move) != NONE);
+        n_moves++;
+        index -= get_digit(get(move))*powers_of_three[move];
+        fields &= ~(u32(3) << move*2);
+    }
+
+    bool can_play(u8 move) const {
+        return get(move) == NONE;
+    }
+
+    // only valid for micro boards, ties of the winners board count as free
+    u16 get_free_cells() const {
+        return STATE_FREE_CELLS(micro_board_states[index]);
+    }
+
+    // free cells which complete a line of player
+    u16 get_winning_cells(u8 player) const {
+        return STATE_WINNING_CELLS(micro_board_states[index], player);
+    }
+
+    // cells which are not NONE, including ties of the winners board
+    u16 get_occupied_cells() const {
+        // one bit per cell at even positions, then squeeze out the gaps
+        u32 x = (fields | (fields >> 1)) & 0x15555;
+        x = (x | (x >> 1)) & 0x3333;
+        x = (x | (x >> 2)) & 0x0f0f;
+        x = (x | (x >> 4)) & 0x00ff;
+        return x | ((fields | (fields >> 1)) >> 16 & 1) << 8;
+    }
+
+    u8 play(u8 move, u8 player){
+        assert(can_play(move));
+        n_moves--;
+
+        unsafe_set(move, player);
+
+#ifdef USE_WINNER_LOOOKUP_TABLE
+        if (player == TIE) return n_moves == 0 ? TIE : NONE;
+
+        // the index does not know about ties, so check for a full board here
+        u8 winner = STATE_WINNER(micro_board_states[index]);
+        return winner == NONE && n_moves == 0 ? TIE : winner;
+#else
+        if (player != TIE && ::is_winner(*this, player)){
+            return player;
+        }
+
+        return n_moves == 0 ? TIE : NONE;
+#endif
+    }
+
+    void print(){
+        printf("+-------+\n");
+        for (int y = 0; y < 3; y++){
+            printf("| ");
+            for (int x = 0; x < 3; x++){
+                printf("%i ", get(x + y*3));
+            }
+            printf("|\n");
+        }
+        printf("+-------+\n\n");
+    }
+
+    int heuristic_player(u8 player, const Weights &weights) const {
+        int score = 0;
+        for (u8 move = 0; move < 9; move++){
+            score += (get(move) == player)*weights[move];
+        }
+        return score;
+    }
+
+    // 0 if player can not win this board anymore, otherwise
+    // 1 plus 2 for every line where player only misses one cell
+    int potential(u8 player) const {
+        MicroBoard copy = *this;
+        if (copy.update() != NONE) return 0;
+
+        u8 opponent = NEXT_PLAYER(player);
+        int result = 0;
+        for (ThreeMoves line : wins){
+            int own = 0;
+            bool open = true;
+            for (u8 move : line){
+                own += get(move) == player;
+                open &= get(move) != opponent;
+            }
+            if (!open) continue;
+            if (result == 0) result = 1;
+            if (own == 2) result += 2;
+        }
+        return result;
+    }
+
+    int heuristic(const Weights &weights) const {
+        return heuristic_player(1, weights) - heuristic_player(2, weights);
+    }
+
+    u8 update(){
+        // n_moves counts the free cells, like in play and clr
+        n_moves = 0;
+        for (u8 move = 0; move < 9; move++){
+            n_moves += get(move) == NONE;
+        }
+
+        u8 result = n_moves == 0 ? TIE : NONE;
+
+        if (is_winner(*this, 1)) result = 1;
+        if (is_winner(*this, 2)) result = 2;
+
+        return result;
+    }
+};
+
+struct MacroBoard {
+    Array<MicroBoard, 9> micro_boards;
+    MicroBoard winners;
+    Moves moves;
+    Accumulator *accumulator = NULL; // kept up to date by play and undo if set
+    Array<u16, 2> winnable = {511, 511}; // micro boards each player has taken or can still take
+
+    void update_winnable(u8 big_move){
+        u32 state = micro_board_states[micro_boards[big_move].index];
+        for (u8 player = 1; player <= 2; player++){
+            u16 &boards = winnable[player - 1];
+            boards = (boards & ~(1 << big_move)) | STATE_CAN_TAKE(state, player) << big_move;
+        }
+    }
+
+    void refresh_winnable(){
+        for (u8 big_move = 0; big_move < 9; big_move++) update_winnable(big_move);
+    }
+
+    // no macro line can be completed by either player,
+    // so the game will end in a tie whatever is played
+    bool is_dead_draw() const {
+        return !contains_line[winnable[0]] && !contains_line[winnable[1]];
+    }
+#ifdef USE_POTENTIAL_EVAL
+    int potential = 0; // sum of weighted potentials, only one term changes per move
+    const Weights *potential_weights = &default_weights; // call refresh_potential after changing
+
+    int get_potential(u8 big_move) const {
+        return (*potential_weights)[big_move]*micro_board_potential[micro_boards[big_move].index];
+    }
+
+    void refresh_potential(){
+        potential = 0;
+        for (u8 big_move = 0; big_move < 9; big_move++) potential += get_potential(big_move);
+    }
+#endif
+
+    bool can_play_anywhere() const {
+        // if no moves done yet
+        if (moves.empty()) return true;
+
+        // if forced small board is decided already
+        return !winners.can_play(moves.back().small_move);
+    }
+
+    bool can_play_big_move(u8 big_move) const {
+        // if small board is decided already, it can't be played
+        if (!winners.can_play(big_move)) return false;
+
+        if (can_play_anywhere()) return true;
+
+        return moves.back().small_move == big_move;
+    }
+
+    // micro boards where the next move can be played
+    u16 get_playable_boards() const {
+        if (can_play_anywhere()) return ~winners.get_occupied_cells() & 511;
+        return 1 << moves.back().small_move;
+    }
+
+    // free cells of a micro board which win it for player
+    u16 get_winning_cells(u8 big_move, u8 player) const {
+        return micro_boards[big_move].get_winning_cells(player);
+    }
+
+    // undecided micro boards which win the game if player takes them
+    u16 get_winning_boards(u8 player) const {
+        return winners.get_winning_cells(player) & ~winners.get_occupied_cells();
+    }
+
+    bool can_play(Move move) const {
+
+        if (!can_play_big_move(move.big_move)) return false;
+
+        // small field to play must still be empty
+        if (!micro_boards[move.big_move].can_play(move.small_move)) return false;
+
+        return true;
+    }
+
+    void undo(){
+        assert(!moves.empty());
+        Move move = moves.back();
+        u8 winner = winners.get(move.big_move);
+        if (winner != NONE){
+            if (accumulator && winner != TIE) accumulator->sub(get_winner_feature(move.big_move, winner));
+            winners.clr(move.big_move);
+        }
+        u8 player = micro_boards[move.big_move].get(move.small_move);
+        if (accumulator) accumulator->sub(get_cell_feature(move.big_move, move.small_move, player));
+#ifdef USE_POTENTIAL_EVAL
+        potential -= get_potential(move.big_move);
+        micro_boards[move.big_move].clr(move.small_move);
+        potential += get_potential(move.big_move);
+#else
+        micro_boards[move.big_move].clr(move.small_move);
+#endif
+        update_winnable(move.big_move);
+        moves.pop_back();
+    }
+
+    // compute accumulator from scratch
+    void refresh_accumulator(){
+        accumulator->clear();
+        for (u8 big_move = 0; big_move < 9; big_move++){
+            for (u8 small_move = 0; small_move < 9; small_move++){
+                u8 player = micro_boards[big_move].get(small_move);
+                if (player != NONE) accumulator->add(get_cell_feature(big_move, small_move, player));
+            }
+            u8 winner = winners.get(big_move);
+            if (winner != NONE && winner != TIE) accumulator->add(get_winner_feature(big_move, winner));
+        }
+    }
+
+    u8 play(Move move, u8 player){
+        if (!can_play(move)){
+            printf("ERROR: player %u wants to play invalid move (%u, %u)\n", player, move.big_move, move.small_move);
+            print();
+            assert(can_play(move));
+        }
+
+        moves.push_back(move);
+
+#ifdef USE_POTENTIAL_EVAL
+        potential -= get_potential(move.big_move);
+        u8 winner = micro_boards[move.big_move].play(move.small_move, player);
+        potential += get_potential(move.big_move);
+#else
+        u8 winner = micro_boards[move.big_move].play(move.small_move, player);
+#endif
+        update_winnable(move.big_move);
+        if (accumulator) accumulator->add(get_cell_feature(move.big_move, move.small_move, player));
+        if (winner != NONE){
+            if (accumulator && winner != TIE) accumulator->add(get_winner_feature(move.big_move, winner));
+            winner = winners.play(move.big_move, winner);
+            if (winner != NONE){
+                return winner;
+            }
+        }
+
+        return NONE;
+    }
+
+    // Like play, but a game which can only end in a tie counts as a tie
+    // right away. Only for searches, the actual game goes on until the end.
+    u8 play_or_draw(Move move, u8 player){
+        u8 winner = play(move, player);
+        return (winner == NONE && is_dead_draw()) ? TIE : winner;
+    }
+/*
+    void print(){
+        for (int i = 0; i < 3; i++) printf("+-------");
+        printf("+\n");
+
+        for (int y = 0; y < 3; y++){
+            for (int i = 0; i < 3; i++){
+                printf("| ");
+                for (int x = 0; x < 3; x++){
+                    const MicroBoard &micro_board = micro_boards[x + y*3];
+                    u8 a = micro_board.get(0 + i*3);
+                    u8 b = micro_board.get(1 + i*3);
+                    u8 c = micro_board.get(2 + i*3);
+                    printf("%i %i %i | ", a, b, c);
+                }
+                printf("\n");
+            }
+
+            for (int i = 0; i < 3; i++) printf("+-------");
+            printf("+\n");
+        }
+        winners.print();
+        printf("\n\n");
+    }
+*/
+    static char translate(u8 player){
+        assert(player < 3);
+        switch (player){
+        case NONE: return '-';
+        case 1: return 'X';
+        case 2: return 'O';
+        default: return '?';
+        }
+    }
+
+    void print(){
+        for (int y = 0; y < 3; y++){
+            for (int i = 0; i < 3; i++){
+                for (int x = 0; x < 3; x++){
+                    const MicroBoard &micro_board = micro_boards[x + y*3];
+                    u8 a = micro_board.get(0 + i*3);
+                    u8 b = micro_board.get(1 + i*3);
+                    u8 c = micro_board.get(2 + i*3);
+                    printf("%c%c%c", translate(a), translate(b), translate(c));
+                }
+                printf("\n");
+            }
+        }
+    }
+};
+
+// 9 if the next player may choose any micro board
+u8 get_forced_big_move(const MacroBoard &macro_board){
+    return macro_board.can_play_anywhere() ? 9 : macro_board.moves.back().small_move;
+}
+
+u64 get_hash(const MacroBoard &macro_board, u8 player){
+    u64 hash = zobrist_forced[get_forced_big_move(macro_board)];
+    if (player == 2) hash ^= zobrist_player;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        const MicroBoard &micro_board = macro_board.micro_boards[big_move];
+        for (u8 small_move = 0; small_move < 9; small_move++){
+            hash ^= zobrist_cells[big_move][small_move][micro_board.get(small_move)];
+        }
+    }
+    return hash;
+}
+
+// get_hash of the position after player plays move, from the hash before
+// and the forced big moves before and after the move
+u64 get_child_hash(u64 hash, Move move, u8 player, u8 old_forced_big_move, u8 new_forced_big_move){
+    hash ^= zobrist_player;
+    hash ^= zobrist_cells[move.big_move][move.small_move][player];
+    hash ^= zobrist_forced[old_forced_big_move];
+    return hash ^ zobrist_forced[new_forced_big_move];
+}
+
+// Indices of the micro boards after applying a symmetry, preceded by the
+// forced micro board. Positions with equal keys are equal for the same
+// player to move, whatever the moves which led there.
+typedef Array<u16, 10> SymmetryKey;
+
+SymmetryKey get_symmetry_key(const MacroBoard &macro_board, u8 symmetry){
+    const NineMoves &permutation = symmetries[symmetry];
+    SymmetryKey key;
+    u8 forced_big_move = get_forced_big_move(macro_board);
+    key[0] = forced_big_move == 9 ? 9 : permutation[forced_big_move];
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        u16 index = macro_board.micro_boards[big_move].index;
+        key[1 + permutation[big_move]] = micro_board_symmetries[symmetry][index];
+    }
+    return key;
+}
+
+bool is_less(const SymmetryKey &a, const SymmetryKey &b){
+    for (u8 i = 0; i < 10; i++){
+        if (a[i] != b[i]) return a[i] < b[i];
+    }
+    return false;
+}
+
+// symmetry which gives the smallest key, all symmetric positions
+// have the same canonical orientation
+u8 get_canonical_symmetry(const MacroBoard &macro_board){
+    u8 best_symmetry = 0;
+    SymmetryKey best_key = get_symmetry_key(macro_board, 0);
+    for (u8 symmetry = 1; symmetry < N_SYMMETRIES; symmetry++){
+        SymmetryKey key = get_symmetry_key(macro_board, symmetry);
+        if (is_less(key, best_key)){
+            best_key = key;
+            best_symmetry = symmetry;
+        }
+    }
+    return best_symmetry;
+}
+
+// bit i is set if symmetry i maps the position onto itself
+u8 get_stabilizer(const MacroBoard &macro_board){
+    SymmetryKey key = get_symmetry_key(macro_board, 0);
+    u8 stabilizer = 1;
+    for (u8 symmetry = 1; symmetry < N_SYMMETRIES; symmetry++){
+        SymmetryKey other = get_symmetry_key(macro_board, symmetry);
+        if (!is_less(key, other) && !is_less(other, key)) stabilizer |= 1 << symmetry;
+    }
+    return stabilizer;
+}
+
+// A move is redundant if a symmetry of the position maps it to a smaller
+// move, which leads to an equivalent position. Exactly one move of every
+// class of equivalent moves is not redundant.
+bool is_redundant_move(Move move, u8 stabilizer){
+    u8 i = move.big_move*9 + move.small_move;
+    for (stabilizer &= ~1; stabilizer; stabilizer &= stabilizer - 1){
+        const NineMoves &permutation = symmetries[__builtin_ctz(stabilizer)];
+        if (permutation[move.big_move]*9 + permutation[move.small_move] < i) return true;
+    }
+    return false;
+}
+
+// Position from the ternary indices of its micro boards and the forced
+// micro board, 9 if any micro board can be played. The only move is the
+// last one, and only its small move is known.
+MacroBoard from_indices(const Array<u16, 9> &indices, u8 forced_big_move){
+    MacroBoard macro_board;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        macro_board.micro_boards[big_move] = MicroBoard::from_index(indices[big_move]);
+    }
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        u8 player = macro_board.micro_boards[big_move].update();
+        if (player == NONE) continue;
+        macro_board.winners.play(big_move, player);
+    }
+    if (forced_big_move != 9){
+        macro_board.moves.push_back(Move{UNKNOWN_BIG_MOVE, forced_big_move});
+    }
+#ifdef USE_POTENTIAL_EVAL
+    macro_board.refresh_potential();
+#endif
+    macro_board.refresh_winnable();
+    return macro_board;
+}
+
+// position after applying a symmetry, with the forced micro board as history
+MacroBoard transform(const MacroBoard &macro_board, u8 symmetry){
+    const NineMoves &permutation = symmetries[symmetry];
+    Array<u16, 9> indices;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        u16 index = macro_board.micro_boards[big_move].index;
+        indices[permutation[big_move]] = micro_board_symmetries[symmetry][index];
+    }
+    u8 forced_big_move = get_forced_big_move(macro_board);
+    return from_indices(indices, forced_big_move == 9 ? 9 : permutation[forced_big_move]);
+}
+
+// same hash for all symmetric positions
+u64 get_canonical_hash(const MacroBoard &macro_board, u8 player){
+    return get_hash(transform(macro_board, get_canonical_symmetry(macro_board)), player);
+}
+
+Move pick_random_move(const MacroBoard &macro_board, Rng &rng){
+    Moves moves;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        if (!macro_board.can_play_big_move(big_move)) continue;
+        const MicroBoard &micro_board = macro_board.micro_boards[big_move];
+        for (u8 small_move = 0; small_move < 9; small_move++){
+            if (!micro_board.can_play(small_move)) continue;
+            Move move{big_move, small_move};
+            moves.push_back(move);
+        }
+    }
+
+    assert(moves.size() > 0);
+
+    return moves[rng() % moves.size()];
+}
+
+Move get_random_move(const MacroBoard &macro_board, u8 player){
+    UNUSED(player);
+
+    return pick_random_move(macro_board, default_rng);
+}
+
+// random move functor with its own random number stream
+struct RandomMove {
+    Rng rng;
+
+    RandomMove(const Rng &rng): rng(rng){}
+
+    Move operator () (const MacroBoard &macro_board, u8 player){
+        UNUSED(player);
+
+        return pick_random_move(macro_board, rng);
+    }
+};
+
+template <typename GET_MOVE_PLAYER1, typename GET_MOVE_PLAYER2>
+u8 get_winner(MacroBoard &macro_board, GET_MOVE_PLAYER1 &get_move_player1, GET_MOVE_PLAYER2 &get_move_player2, u8 player, Moves &moves){
+    for (int round = 0; round < MAX_MOVES; round++){
+
+        Move move;
+        if (player == 1){
+            move = get_move_player1(macro_board, player);
+        }else{
+            move = get_move_player2(macro_board, player);
+        }
+        moves.push_back(move);
+
+        u8 winner = macro_board.play(move, player);
+
+        if (winner != NONE){
+            return winner;
+        }
+
+        player = NEXT_PLAYER(player);
+    }
+
+    return TIE;
+}
+
+struct MacroScore {
+    int value;
+    Moves moves;
+};
+
+#ifdef USE_PROBABILITY_EVAL
+// Probability that X minus probability that O wins the macro board if the
+// micro boards are taken independently with the tabled probabilities.
+int get_probability_score(const MacroBoard &macro_board, u8 player){
+    Array<Array<float, 2>, 9> p;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        u8 winner = macro_board.winners.get(big_move);
+        if (winner == NONE){
+            p[big_move] = micro_board_probabilities[player - 1][macro_board.micro_boards[big_move].index];
+        }else{
+            p[big_move][0] = winner == 1;
+            p[big_move][1] = winner == 2;
+        }
+    }
+
+    // lines are treated as independent as well
+    float no_line_x = 1.0f;
+    float no_line_o = 1.0f;
+    for (ThreeMoves line : wins){
+        no_line_x *= 1.0f - p[line[0]][0]*p[line[1]][0]*p[line[2]][0];
+        no_line_o *= 1.0f - p[line[0]][1]*p[line[1]][1]*p[line[2]][1];
+    }
+
+    return int(PROBABILITY_SCORE*(no_line_o - no_line_x));
+}
+#endif
+
+#ifdef USE_HEURISTIC_LOOKUP_TABLE
+// micro_board_score for other weights
+struct ScoreTable {
+    Weights weights;
+    i16 scores[N_MICRO_BOARDS];
+    ScoreTable *next;
+};
+
+ScoreTable *score_tables = NULL;
+std::mutex score_tables_mutex;
+
+bool is_same_weights(const Weights &a, const Weights &b){
+    for (u8 i = 0; i < 9; i++){
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+// Tables are built on first use and kept for the lifetime of the process,
+// so engines with the same weights share one table.
+const i16* get_score_table(const Weights &weights){
+    if (is_same_weights(weights, default_weights)) return micro_board_score;
+
+    std::lock_guard<std::mutex> lock(score_tables_mutex);
+    for (ScoreTable *table = score_tables; table; table = table->next){
+        if (is_same_weights(weights, table->weights)) return table->scores;
+    }
+
+    ScoreTable *table = new ScoreTable;
+    table->weights = weights;
+    for (u32 i = 0; i < N_MICRO_BOARDS; i++){
+        int score = MicroBoard::from_index(i).heuristic(weights);
+        assert(score >= INT16_MIN && score <= INT16_MAX);
+        table->scores[i] = score;
+    }
+    table->next = score_tables;
+    score_tables = table;
+    return table->scores;
+}
+#endif
+
+#ifdef USE_TABLEBASE_PROBE
+struct Tablebase;
+// defined in tablebase.hpp
+bool probe_tablebase(const Tablebase &tablebase, const MacroBoard &macro_board, u8 player, int &score);
+#endif
+
+struct MacroAlphaBeta {
+    MacroBoard macro_board;
+
+    int lookahead;
+    Weights weights;
+    NineMoves move_order;
+    const Nnue *nnue; // evaluates leaves instead of weights if set
+    Accumulator accumulator;
+#ifdef USE_TABLEBASE_PROBE
+    const Tablebase *tablebase; // exact scores of endgames below the root if set
+#endif
+#ifdef USE_HEURISTIC_LOOKUP_TABLE
+    const i16 *score_table; // heuristic of weights for every micro board
+    Weights table_weights;  // weights of score_table
+#endif
+    u64 n_nodes;
+
+    MacroAlphaBeta(
+        int lookahead,
+        const Weights &weights = default_weights,
+        const NineMoves &move_order = default_move_order
+    ):
+        lookahead(lookahead),
+        weights(weights),
+        move_order(move_order),
+        nnue(NULL),
+        n_nodes(0)
+    {
+#ifdef USE_TABLEBASE_PROBE
+        tablebase = NULL;
+#endif
+#ifdef USE_HEURISTIC_LOOKUP_TABLE
+        score_table = get_score_table(weights);
+        table_weights = weights;
+#endif
+    }
+
+    // search on a copy of macro_board
+    void set_board(const MacroBoard &macro_board){
+        this->macro_board = macro_board;
+
+#ifdef USE_HEURISTIC_LOOKUP_TABLE
+        // weights might have been changed since the last search
+        if (!is_same_weights(weights, table_weights)){
+            score_table = get_score_table(weights);
+            table_weights = weights;
+        }
+#endif
+
+#if 1
+        // discard all previous moves except the last one for faster copying
+        if (!macro_board.moves.empty()){
+            auto &moves = this->macro_board.moves;
+            Move last_move = moves.back();
+            moves.clear();
+            moves.push_back(last_move);
+        }
+#endif
+
+#ifdef USE_POTENTIAL_EVAL
+        this->macro_board.potential_weights = &weights;
+        this->macro_board.refresh_potential();
+#endif
+
+        this->macro_board.accumulator = NULL;
+        if (nnue){
+            accumulator.nnue = nnue;
+            this->macro_board.accumulator = &accumulator;
+            this->macro_board.refresh_accumulator();
+        }
+    }
+
+    // heuristic of weights for the decided micro boards
+    int get_winners_score() const {
+#ifdef USE_HEURISTIC_LOOKUP_TABLE
+        return score_table[macro_board.winners.index];
+#else
+        return macro_board.winners.heuristic(weights);
+#endif
+    }
+
+    MacroScore descend(u8 player, int depth, int alpha = -MAX_SCORE, int beta = +MAX_SCORE){
+        u8 opponent = NEXT_PLAYER(player);
+        n_nodes++;
+
+#ifdef USE_TABLEBASE_PROBE
+        // the root still needs a move
+        int tablebase_score;
+        if (tablebase && depth != lookahead && probe_tablebase(*tablebase, macro_board, player, tablebase_score)){
+            return MacroScore{tablebase_score, macro_board.moves};
+        }
+#endif
+
+        if (depth == 0){
+            int score;
+            if (nnue){
+                score = accumulator.evaluate();
+            }else{
+#if defined(USE_PROBABILITY_EVAL)
+                score = get_probability_score(macro_board, player);
+#elif defined(USE_POTENTIAL_EVAL)
+                score = POTENTIAL_WIN_SCALE*get_winners_score() + macro_board.potential;
+#else
+                score = get_winners_score();
+#endif
+            }
+            if (player == 2) score = -score;
+            return MacroScore{score, macro_board.moves};
+        }
+
+        // win right away if possible, one lookup per board
+        u16 boards = macro_board.get_winning_boards(player) & macro_board.get_playable_boards();
+        for (; boards; boards &= boards - 1){
+            u8 big_move = __builtin_ctz(boards);
+            u16 cells = macro_board.get_winning_cells(big_move, player);
+            if (!cells) continue;
+
+            macro_board.play(Move{big_move, u8(__builtin_ctz(cells))}, player);
+            MacroScore score{+MAX_SCORE, macro_board.moves};
+            macro_board.undo();
+            return score;
+        }
+
+        MacroScore best_score;
+        bool no_score = true;
+
+        for (u8 big_move : move_order){
+            if (!macro_board.can_play_big_move(big_move)) continue;
+            u16 free_cells = macro_board.micro_boards[big_move].get_free_cells();
+            for (u8 small_move : move_order){
+                if (!((free_cells >> small_move) & 1)) continue;
+                Move move{big_move, small_move};
+
+                u8 winner = macro_board.play_or_draw(move, player);
+
+                MacroScore new_score;
+
+                if (winner == NONE){
+                    new_score = descend(opponent, depth - 1, -beta, -alpha);
+                    new_score.value = -new_score.value;
+                }else if (winner == TIE){
+                    new_score = MacroScore{0, macro_board.moves};
+                }else{
+                    int score = (player == winner) ? +MAX_SCORE : -MAX_SCORE;
+                    new_score = MacroScore{score, macro_board.moves};
+                }
+
+                macro_board.undo();
+
+                if (no_score || best_score.value < new_score.value){
+                    no_score = false;
+                    best_score = new_score;
+                }
+                if (alpha < best_score.value) alpha = best_score.value;
+                if (beta <= alpha) return best_score;
+            }
+        }
+
+        // there must have been a living branch because game did not tie yet
+        assert(!no_score);
+
+        return best_score;
+    }
+
+    Move operator () (const MacroBoard &macro_board, u8 player){
+        set_board(macro_board);
+
+        MacroScore score = descend(player, lookahead);
+
+#if 1
+        assert(!score.moves.empty());
+        return score.moves[macro_board.moves.empty() ? 0 : 1];
+#else
+        assert(score.moves.size() > macro_board.moves.size());
+        return score.moves[macro_board.moves.size()];
+#endif
+    }
+};
+
+MacroBoard from_buffer(const Array<char, MAX_MOVES> &buffer, int x0, int y0){
+    MacroBoard macro_board;
+    int k = 0;
+    if (x0 != -1 && y0 != -1){
+        macro_board.moves.push_back(Move{UNKNOWN_BIG_MOVE, u8(x0 + y0*3)});
+    }
+    for (int y = 0; y < 3; y++){
+        for (int i = 0; i < 3; i++){
+            for (int x = 0; x < 3; x++){
+                for (int j = 0; j < 3; j++){
+                    u8 move = i*3 + j;
+                    char c = buffer[k++];
+                    if (c == '-') continue;
+                    if (c != 'X' && c != 'O'){
+                        fprintf(stderr, "Invalid character: %c\n", c);
+                        assert("Invalid character");
+                    }
+                    u8 player = c == 'X' ? 1 : 2;
+                    macro_board.micro_boards[x + y*3].unsafe_set(move, player);
+                }
+            }
+        }
+    }
+    for (u8 move = 0; move < 9; move++){
+        u8 player = macro_board.micro_boards[move].update();
+        if (player == NONE) continue;
+        macro_board.winners.play(move, player);
+    }
+#ifdef USE_POTENTIAL_EVAL
+    macro_board.refresh_potential();
+#endif
+    macro_board.refresh_winnable();
+    return macro_board;
+}
+
+// Position from 81 cells of X, O and - in the order of from_buffer and the
+// forced micro board as x + 3*y, or -1 for any. X moves first, so the
+// player to move follows from the number of cells.
+MacroBoard from_string(const char *cells, int forced_big_move, u8 &player){
+    assert(strlen(cells) == MAX_MOVES);
+    Array<char, MAX_MOVES> buffer;
+    int n_x = 0;
+    int n_o = 0;
+    for (int i = 0; i < MAX_MOVES; i++){
+        buffer[i] = cells[i];
+        n_x += cells[i] == 'X';
+        n_o += cells[i] == 'O';
+    }
+    player = n_x > n_o ? 2 : 1;
+    if (forced_big_move == -1) return from_buffer(buffer, -1, -1);
+    return from_buffer(buffer, forced_big_move % 3, forced_big_move / 3);
+}
+
+#ifdef USE_PROBABILITY_EVAL
+// Play random games on a single micro board, where the players take turns,
+// and count how often each player takes it.
+void init_micro_board_probabilities(){
+    Rng rng(DEFAULT_SEED, 0x3b);
+    for (u32 index = 0; index < N_MICRO_BOARDS; index++){
+        if (STATE_WINNER(micro_board_states[index]) != NONE) continue;
+
+        MicroBoard micro_board = MicroBoard::from_index(index);
+        u32 cells[2] = {0, 0};
+        for (u8 move = 0; move < 9; move++){
+            u8 player = micro_board.get(move);
+            if (player != NONE) cells[player - 1] |= 1 << move;
+        }
+
+        for (u8 first_player = 1; first_player <= 2; first_player++){
+            Array<u32, 3> counts = {0, 0, 0};
+            for (u32 i = 0; i < MICRO_BOARD_PLAYOUTS; i++){
+                u32 own[2] = {cells[0], cells[1]};
+                u32 free = ((1 << 9) - 1) & ~(own[0] | own[1]);
+                u8 player = first_player;
+                u8 winner = TIE;
+                while (free){
+                    u32 n = __builtin_popcount(free);
+                    u32 remaining = free;
+                    for (u32 k = rng() % n; k > 0; k--) remaining &= remaining - 1;
+                    u32 cell = remaining & -remaining;
+                    if (winning_cells[own[player - 1]] & cell){
+                        winner = player;
+                        break;
+                    }
+                    own[player - 1] |= cell;
+                    free &= ~cell;
+                    player = NEXT_PLAYER(player);
+                }
+                counts[winner == TIE ? 0 : winner]++;
+            }
+
+            Array<float, 2> &p = micro_board_probabilities[first_player - 1][index];
+            p[0] = counts[1]/float(MICRO_BOARD_PLAYOUTS);
+            p[1] = counts[2]/float(MICRO_BOARD_PLAYOUTS);
+        }
+    }
+}
+#endif
+
+#ifdef GENERATE_TABLES
+void generate_tables(){
+    for (u32 cells = 0; cells < (1 << 9); cells++){
+        winning_cells[cells] = 0;
+        contains_line[cells] = false;
+        for (ThreeMoves moves : wins){
+            u32 line = (1 << moves[0]) | (1 << moves[1]) | (1 << moves[2]);
+            u32 missing = line & ~cells;
+            // exactly one cell of the line is missing
+            if (missing && !(missing & (missing - 1))) winning_cells[cells] |= missing;
+            if (!missing) contains_line[cells] = true;
+        }
+    }
+
+    for (u32 i = 0; i < N_MICRO_BOARDS; i++){
+        for (u8 symmetry = 0; symmetry < N_SYMMETRIES; symmetry++){
+            u32 index = 0;
+            u32 digits = i;
+            for (u8 move = 0; move < 9; move++){
+                index += (digits % 3)*powers_of_three[symmetries[symmetry][move]];
+                digits /= 3;
+            }
+            micro_board_symmetries[symmetry][i] = index;
+        }
+    }
+
+    for (u32 i = 0; i < N_MICRO_BOARDS; i++){
+        MicroBoard micro_board = MicroBoard::from_index(i);
+        u32 free_cells = 0;
+        Array<u32, 2> cells = {0, 0};
+        for (u8 move = 0; move < 9; move++){
+            u8 player = micro_board.get(move);
+            if (player == NONE) free_cells |= 1 << move;
+            else cells[player - 1] |= 1 << move;
+        }
+        u32 x_wins = winning_cells[cells[0]] & free_cells;
+        u32 o_wins = winning_cells[cells[1]] & free_cells;
+        u8 winner = micro_board.update();
+        // a line without cells of the opponent can still be completed
+        u32 can_take[3] = {0, winner == 1, winner == 2};
+        if (winner == NONE){
+            can_take[1] = contains_line[cells[0] | free_cells];
+            can_take[2] = contains_line[cells[1] | free_cells];
+        }
+        micro_board_states[i] = free_cells | winner << 9 | x_wins << 11 | o_wins << 20 | can_take[1] << 29 | can_take[2] << 30;
+        micro_board_score[i] = micro_board.heuristic(default_weights);
+        micro_board_potential[i] = micro_board.potential(1) - micro_board.potential(2);
+    }
+}
+#endif
+
+// tables which are not generated at build time
+void init(){
+#ifdef USE_PROBABILITY_EVAL
+    init_micro_board_probabilities();
+#endif
+
+    Rng rng(DEFAULT_SEED, 0x2b);
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        for (u8 small_move = 0; small_move < 9; small_move++){
+            // empty cells do not change the hash
+            zobrist_cells[big_move][small_move][NONE] = 0;
+            zobrist_cells[big_move][small_move][1] = rng.next_u64();
+            zobrist_cells[big_move][small_move][2] = rng.next_u64();
+        }
+    }
+    for (u64 &key : zobrist_forced) key = rng.next_u64();
+    zobrist_player = rng.next_u64();
+}
+
+Move pick_probable_move(const MacroBoard &macro_board0, u8 player, const Rng &rng){
+    Array<Array<int, 9>, 9> scores = {};
+    Array<Array<int, 9>, 9> counts = {};
+
+    for (int i = 0; i < 100*1000; i++){
+        MacroBoard macro_board = macro_board0;
+        Moves moves;
+        // each game has its own stream so games could run in any order
+        RandomMove get_move(rng.fork(i));
+        u8 winner = get_winner(macro_board, get_move, get_move, player, moves);
+        Move first_move = moves[0];
+        counts[first_move.big_move][first_move.small_move]++;
+        if (winner == player){
+            scores[first_move.big_move][first_move.small_move] += 1;
+        }
+        if (winner != player){
+            scores[first_move.big_move][first_move.small_move] -= 1;
+        }
+    }
+
+    int max_score = INT_MIN;
+    bool no_move = true;
+    Move move;
+
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        for (u8 small_move = 0; small_move < 9; small_move++){
+            if (counts[big_move][small_move] == 0) continue;
+            int score = scores[big_move][small_move];
+            if (no_move || max_score < score){
+                max_score = score;
+                no_move = false;
+                move = Move{big_move, small_move};
+            }
+        }
+    }
+
+    return move;
+}
+
+Move get_probable_move(const MacroBoard &macro_board, u8 player){
+    return pick_probable_move(macro_board, player, Rng(rd()));
+}
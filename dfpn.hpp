@@ -0,0 +1,253 @@
+#pragma once
+
+#include "common.hpp"
+
+#define DFPN_INF (1u << 30)
+#define DFPN_BUCKET 2 // entries per bucket, the one with less work is replaced
+#define DFPN_NO_MOVE (Move{9, 9}) // of a position where the game is over
+
+// Proof and disproof numbers of a position for one goal of the attacker.
+// work counts the nodes searched below the position, so entries which
+// were expensive to compute stay in the table.
+struct DfpnEntry {
+    u64 hash; // 0 if empty
+    u32 pn;
+    u32 dn;
+    u32 work;
+};
+
+struct DfpnChild {
+    Move move;
+    u64 hash;
+    u8 winner; // result of the move, NONE if the game goes on
+};
+
+u32 add_saturated(u32 a, u32 b){
+    return a + b >= DFPN_INF ? DFPN_INF : a + b;
+}
+
+// Depth-first proof-number search. A search proves or disproves a goal
+// of the attacker, the player to move at the root: to win, or to win or
+// tie. Most games end in a tie, so solve runs two such searches, win
+// against no win and loss against no loss, instead of one search with
+// three outcomes. Positions which neither player can win anymore count as
+// ties right away. The game has no cycles, so transpositions only make
+// proof numbers too large but never wrong. The table is bounded and
+// found by the zobrist hash, with a different key for each goal.
+struct DfpnSolver {
+    DfpnEntry *entries;
+    u64 mask;         // of buckets
+    u64 max_nodes;    // give up after this many nodes
+    u64 n_nodes;
+
+    MacroBoard macro_board;
+    u8 attacker;
+    bool ties_win;    // whether a tie achieves the goal
+    u64 goal_key;
+
+    DfpnSolver(u64 megabytes, u64 max_nodes = UINT64_MAX): max_nodes(max_nodes), n_nodes(0){
+        u64 n = DFPN_BUCKET;
+        while (2*n*sizeof(DfpnEntry) <= megabytes << 20) n *= 2;
+        entries = new DfpnEntry[n]();
+        mask = n/DFPN_BUCKET - 1;
+    }
+
+    ~DfpnSolver(){
+        delete[] entries;
+    }
+
+    DfpnSolver(const DfpnSolver&) = delete;
+    DfpnSolver& operator = (const DfpnSolver&) = delete;
+
+    void clear(){
+        for (u64 i = 0; i < (mask + 1)*DFPN_BUCKET; i++) entries[i] = DfpnEntry{0, 0, 0, 0};
+    }
+
+    void lookup(u64 hash, u32 &pn, u32 &dn) const {
+        hash ^= goal_key;
+        const DfpnEntry *bucket = &entries[(hash & mask)*DFPN_BUCKET];
+        for (u32 i = 0; i < DFPN_BUCKET; i++){
+            if (bucket[i].hash != hash) continue;
+            pn = bucket[i].pn;
+            dn = bucket[i].dn;
+            return;
+        }
+        pn = 1;
+        dn = 1;
+    }
+
+    void store(u64 hash, u32 pn, u32 dn, u32 work){
+        hash ^= goal_key;
+        DfpnEntry *bucket = &entries[(hash & mask)*DFPN_BUCKET];
+        DfpnEntry *entry = &bucket[0];
+        for (u32 i = 0; i < DFPN_BUCKET; i++){
+            if (bucket[i].hash == hash){
+                entry = &bucket[i];
+                break;
+            }
+            if (bucket[i].work < entry->work) entry = &bucket[i];
+        }
+        *entry = DfpnEntry{hash, pn, dn, work};
+    }
+
+    bool is_goal(u8 winner) const {
+        return winner == attacker || (winner == TIE && ties_win);
+    }
+
+    void get_children(u8 player, u64 hash, SmallVector<DfpnChild, MAX_MOVES> &children){
+        u8 forced_big_move = get_forced_big_move(macro_board);
+        for (u8 big_move = 0; big_move < 9; big_move++){
+            if (!macro_board.can_play_big_move(big_move)) continue;
+            u16 free_cells = macro_board.micro_boards[big_move].get_free_cells();
+            for (; free_cells; free_cells &= free_cells - 1){
+                Move move{big_move, u8(__builtin_ctz(free_cells))};
+                u8 winner = macro_board.play_or_draw(move, player);
+
+                u64 child_hash = get_child_hash(hash, move, player, forced_big_move, get_forced_big_move(macro_board));
+
+                macro_board.undo();
+                children.push_back(DfpnChild{move, child_hash, winner});
+            }
+        }
+    }
+
+    // proof and disproof numbers of a child for the goal
+    void get_numbers(const DfpnChild &child, u32 &pn, u32 &dn) const {
+        if (child.winner == NONE){
+            lookup(child.hash, pn, dn);
+        }else if (is_goal(child.winner)){
+            pn = 0;
+            dn = DFPN_INF;
+        }else{
+            pn = DFPN_INF;
+            dn = 0;
+        }
+    }
+
+    // Search below the position until its proof number reaches max_pn or
+    // its disproof number reaches max_dn. The attacker takes the minimum
+    // proof number of the children, the defender the minimum disproof number.
+    void descend(u8 player, u64 hash, u32 max_pn, u32 max_dn){
+        u64 first_node = n_nodes++;
+        bool is_or = player == attacker;
+
+        SmallVector<DfpnChild, MAX_MOVES> children;
+        get_children(player, hash, children);
+
+        u32 pn, dn;
+        while (true){
+            // numbers of the node, best child and second best number
+            u32 sum = 0;
+            u32 best = DFPN_INF;
+            u32 second = DFPN_INF;
+            u32 best_child = 0;
+            u32 best_pn = 0, best_dn = 0;
+            for (u32 i = 0; i < children.size(); i++){
+                u32 child_pn, child_dn;
+                get_numbers(children[i], child_pn, child_dn);
+                u32 own = is_or ? child_pn : child_dn;
+                sum = add_saturated(sum, is_or ? child_dn : child_pn);
+                if (own < best){
+                    second = best;
+                    best = own;
+                    best_child = i;
+                    best_pn = child_pn;
+                    best_dn = child_dn;
+                }else if (own < second){
+                    second = own;
+                }
+            }
+            pn = is_or ? best : sum;
+            dn = is_or ? sum : best;
+
+            if (pn >= max_pn || dn >= max_dn || n_nodes >= max_nodes) break;
+
+            u32 child_max_pn, child_max_dn;
+            if (is_or){
+                child_max_pn = max_pn < second + 1 ? max_pn : second + 1;
+                child_max_dn = max_dn - dn + best_dn;
+            }else{
+                child_max_dn = max_dn < second + 1 ? max_dn : second + 1;
+                child_max_pn = max_pn - pn + best_pn;
+            }
+
+            macro_board.play(children[best_child].move, player);
+            descend(NEXT_PLAYER(player), children[best_child].hash, child_max_pn, child_max_dn);
+            macro_board.undo();
+        }
+
+        u64 work = n_nodes - first_node;
+        store(hash, pn, dn, work > UINT32_MAX ? UINT32_MAX : u32(work));
+    }
+
+    // Returns whether the goal was proven and sets move to a move which
+    // achieves it, or to the first move otherwise, or to DFPN_NO_MOVE if
+    // there is none. Sets solved to false if the search ran out of nodes.
+    bool prove(u8 player, bool ties_win, Move &move, bool &solved){
+        this->attacker = player;
+        this->ties_win = ties_win;
+        goal_key = ties_win ? 0x5bd1e9955bd1e995 : 0;
+
+        u64 hash = get_hash(macro_board, player);
+        descend(player, hash, DFPN_INF, DFPN_INF);
+
+        u32 pn, dn;
+        lookup(hash, pn, dn);
+        solved = pn == 0 || dn == 0;
+
+        SmallVector<DfpnChild, MAX_MOVES> children;
+        get_children(player, hash, children);
+        move = children.empty() ? DFPN_NO_MOVE : children[0].move;
+        if (pn != 0) return false;
+
+        // The entry of the proven child might have been replaced since,
+        // then the children are searched again until one is proven.
+        for (u32 pass = 0; pass < 2; pass++){
+            for (const DfpnChild &child : children){
+                if (pass == 1 && child.winner == NONE){
+                    macro_board.play(child.move, player);
+                    descend(NEXT_PLAYER(player), child.hash, DFPN_INF, DFPN_INF);
+                    macro_board.undo();
+                }
+                u32 child_pn, child_dn;
+                get_numbers(child, child_pn, child_dn);
+                if (child_pn == 0){
+                    move = child.move;
+                    return true;
+                }
+            }
+        }
+        // out of nodes before the move was found again
+        solved = false;
+        return false;
+    }
+
+    // Winner with perfect play and a move which achieves it, any move if
+    // player loses, or NONE if the searches ran out of nodes. If the game
+    // is over, the winner and DFPN_NO_MOVE.
+    u8 solve(const MacroBoard &macro_board, u8 player, Move &move){
+        MicroBoard winners = macro_board.winners;
+        u8 winner = winners.update();
+        if (winner != NONE){
+            move = DFPN_NO_MOVE;
+            return winner;
+        }
+
+        this->macro_board = macro_board;
+        // discard all previous moves except the last one for faster copying
+        if (!macro_board.moves.empty()){
+            auto &moves = this->macro_board.moves;
+            Move last_move = moves.back();
+            moves.clear();
+            moves.push_back(last_move);
+        }
+
+        n_nodes = 0;
+        bool solved;
+        if (prove(player, false, move, solved)) return player;
+        if (!solved) return NONE;
+        if (prove(player, true, move, solved)) return TIE;
+        if (!solved) return NONE;
+        return NEXT_PLAYER(player);
+    }
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "common.hpp"
+#include "bitboard.hpp"
+
+// Position as the ternary index of every micro board, the forced micro
+// board (9 if any micro board can be played) and the player to move.
+// Converting from and to the board representations costs one pass over
+// each micro board, unlike parsing the text formats.
+struct Position {
+    Array<u16, 9> micro_boards;
+    u8 forced_big_move;
+    u8 player;
+};
+
+Position to_position(const MacroBoard &macro_board, u8 player){
+    Position position;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        position.micro_boards[big_move] = macro_board.micro_boards[big_move].index;
+    }
+    position.forced_big_move = get_forced_big_move(macro_board);
+    position.player = player;
+    return position;
+}
+
+MacroBoard to_macro_board(const Position &position){
+    return from_indices(position.micro_boards, position.forced_big_move);
+}
+
+// BitBoard has the layout of struct board in magic.c
+Position to_position(const BitBoard &bit_board, u8 player){
+    Position position;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        u16 index = 0;
+        for (u8 small_move = 0; small_move < 9; small_move++){
+            if ((bit_board.cells[0][big_move] >> small_move) & 1) index += powers_of_three[small_move];
+            if ((bit_board.cells[1][big_move] >> small_move) & 1) index += 2*powers_of_three[small_move];
+        }
+        position.micro_boards[big_move] = index;
+    }
+    position.forced_big_move = bit_board.can_play_anywhere() ? 9 : bit_board.forced_big_move;
+    position.player = player;
+    return position;
+}
+
+BitBoard to_bit_board(const Position &position){
+    BitBoard bit_board(MacroBoard{});
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        u32 state = micro_board_states[position.micro_boards[big_move]];
+        u16 index = position.micro_boards[big_move];
+        for (u8 small_move = 0; small_move < 9; small_move++, index /= 3){
+            u8 player = index % 3;
+            if (player == NONE) continue;
+            bit_board.micro_boards[player - 1][big_move] |= move_masks[small_move];
+            bit_board.cells[player - 1][big_move] |= 1 << small_move;
+        }
+        bit_board.micro_moves[big_move] = STATE_FREE_CELLS(state);
+
+        u8 winner = STATE_WINNER(state);
+        if (winner == NONE && !STATE_FREE_CELLS(state)) winner = TIE;
+        if (winner == NONE) continue;
+        bit_board.macro_moves &= ~(1 << big_move);
+        if (winner != TIE) bit_board.macro_boards[winner - 1] |= move_masks[big_move];
+    }
+    bit_board.forced_big_move = position.forced_big_move;
+    return bit_board;
+}
+
+bool is_same_position(const Position &a, const Position &b){
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        if (a.micro_boards[big_move] != b.micro_boards[big_move]) return false;
+    }
+    return a.forced_big_move == b.forced_big_move && a.player == b.player;
+}
+
+#define N_DIFFS (2*9 + 1)     // X minus O cells of a micro board, -9 to +9
+#define N_SUMS (2*MAX_MOVES + 1) // X minus O cells of several micro boards
+#define NO_RANK 0xffff
+
+// Numbers positions densely, from 0 to n_positions - 1, so that position
+// databases can be flat arrays and every position fits in 128 bits.
+// Plain ternary digits would need 3^81 > 2^128 values for the cells alone.
+// Only positions of games which X started are numbered:
+// - every micro board is in a state which a game can reach, so at most
+//   one player has a line and it was completed by the last move there;
+// - X has as many cells as O if X is to move, and one more otherwise,
+//   so the player to move is not stored.
+// Ranks are ordered by player to move, then micro board 0 to 8 by
+// difference of cells and by index, then the forced micro board.
+struct PositionRanker {
+    Array<i8, N_MICRO_BOARDS> state_diffs;
+    Array<u16, N_MICRO_BOARDS> state_ranks; // among states with the same difference
+    Array<u16, N_MICRO_BOARDS> sorted_states; // by difference, then by index
+    Array<u16, N_DIFFS + 1> diff_starts;      // of each difference in sorted_states
+    // number of ways for micro boards i to 8 to add up to a difference
+    Array<Array<u128, N_SUMS>, 10> completions;
+    Array<u128, 2> n_boards; // micro board combinations with X or O to move
+    u128 n_positions;
+
+    PositionRanker(){
+        Array<u16, N_DIFFS> counts = {};
+        for (u32 i = 0; i < N_MICRO_BOARDS; i++){
+            MicroBoard micro_board = MicroBoard::from_index(i);
+            int diff = 0;
+            for (u8 move = 0; move < 9; move++){
+                if (micro_board.get(move) == 1) diff++;
+                if (micro_board.get(move) == 2) diff--;
+            }
+            state_diffs[i] = diff;
+            state_ranks[i] = is_reachable(micro_board) ? counts[diff + 9]++ : NO_RANK;
+        }
+
+        diff_starts[0] = 0;
+        for (u8 d = 0; d < N_DIFFS; d++) diff_starts[d + 1] = diff_starts[d] + counts[d];
+        for (u32 i = 0; i < N_MICRO_BOARDS; i++){
+            if (state_ranks[i] == NO_RANK) continue;
+            sorted_states[diff_starts[state_diffs[i] + 9] + state_ranks[i]] = i;
+        }
+
+        for (u128 &n : completions[9]) n = 0;
+        completions[9][MAX_MOVES] = 1;
+        for (int i = 8; i >= 0; i--){
+            for (int sum = -MAX_MOVES; sum <= MAX_MOVES; sum++){
+                u128 n = 0;
+                for (int diff = -9; diff <= 9; diff++){
+                    n += counts[diff + 9]*get_completions(i + 1, sum - diff);
+                }
+                completions[i][sum + MAX_MOVES] = n;
+            }
+        }
+
+        n_boards[0] = completions[0][0 + MAX_MOVES];
+        n_boards[1] = completions[0][1 + MAX_MOVES];
+        // just below 2^128
+        n_positions = (n_boards[0] + n_boards[1])*10;
+    }
+
+    static bool is_reachable(const MicroBoard &micro_board){
+        Array<u16, 2> cells = {0, 0};
+        for (u8 move = 0; move < 9; move++){
+            u8 player = micro_board.get(move);
+            if (player != NONE) cells[player - 1] |= 1 << move;
+        }
+        if (contains_line[cells[0]] && contains_line[cells[1]]) return false;
+        for (u16 player_cells : cells){
+            if (!contains_line[player_cells]) continue;
+            // the line was completed by the last move on this board
+            bool found = false;
+            for (u16 rest = player_cells; rest; rest &= rest - 1){
+                if (!contains_line[player_cells & ~(rest & -rest)]) found = true;
+            }
+            if (!found) return false;
+        }
+        return true;
+    }
+
+    u128 get_completions(int i, int sum) const {
+        if (sum < -MAX_MOVES || sum > MAX_MOVES) return 0;
+        return completions[i][sum + MAX_MOVES];
+    }
+
+    u128 rank(const Position &position) const {
+        // difference the remaining micro boards have to add up to
+        int sum = position.player == 1 ? 0 : 1;
+        u128 result = position.player == 1 ? 0 : n_boards[0];
+
+        for (u8 i = 0; i < 9; i++){
+            u16 index = position.micro_boards[i];
+            int diff = state_diffs[index];
+            assert(state_ranks[index] != NO_RANK);
+
+            // skip the combinations with smaller differences on this board
+            for (int smaller = -9; smaller < diff; smaller++){
+                u32 count = diff_starts[smaller + 10] - diff_starts[smaller + 9];
+                result += count*get_completions(i + 1, sum - smaller);
+            }
+            result += state_ranks[index]*get_completions(i + 1, sum - diff);
+            sum -= diff;
+        }
+        assert(sum == 0);
+
+        return result*10 + position.forced_big_move;
+    }
+
+    Position unrank(u128 rank) const {
+        assert(rank < n_positions);
+        Position position;
+        position.forced_big_move = rank % 10;
+        rank /= 10;
+
+        int sum = 0;
+        position.player = 1;
+        if (rank >= n_boards[0]){
+            rank -= n_boards[0];
+            sum = 1;
+            position.player = 2;
+        }
+
+        for (u8 i = 0; i < 9; i++){
+            for (int diff = -9; diff <= 9; diff++){
+                u32 count = diff_starts[diff + 10] - diff_starts[diff + 9];
+                u128 n = get_completions(i + 1, sum - diff);
+                if (rank >= count*n){
+                    rank -= count*n;
+                    continue;
+                }
+                u32 state_rank = rank / n;
+                rank %= n;
+                position.micro_boards[i] = sorted_states[diff_starts[diff + 9] + state_rank];
+                sum -= diff;
+                break;
+            }
+        }
+
+        return position;
+    }
+};
@@ -0,0 +1,187 @@
+// Writes the endgame tablebase of tablebase.hpp by retrograde analysis:
+//     ./gen_tablebase [path] [max cells]
+// Positions are solved by the number of free cells in undecided micro
+// boards, from 1 up to max cells, so the children of every position are
+// either over or already in the table. Only one position of every group
+// with the same key is solved, the one with the smallest micro board
+// indices and winners board.
+#include <algorithm>
+#include <vector>
+
+#include "common.hpp"
+#include "tablebase.hpp"
+#include "timer.hpp"
+
+// cells of the winners board which are free, X, O and tied
+void get_cells(u32 winners_fields, Array<u16, 4> &cells){
+    cells = {0, 0, 0, 0};
+    for (u8 move = 0; move < 9; move++) cells[(winners_fields >> 2*move) & 3] |= 1 << move;
+}
+
+struct TablebaseGenerator {
+    Tablebase tablebase;
+    std::vector<u64> entries;
+    // smallest micro board of every key by its number of free cells
+    Array<std::vector<u16>, TABLEBASE_MAX_CELLS + 1> micro_boards;
+    std::vector<u32> winners_boards;
+
+    // position which is being enumerated
+    u32 winners_fields;
+    Array<u16, 9> indices;
+    u64 n_level;
+
+    TablebaseGenerator(u32 max_cells){
+        for (u32 i = 0; i < N_MICRO_BOARDS; i++){
+            u32 state = micro_board_states[i];
+            u32 n_free = __builtin_popcount(STATE_FREE_CELLS(state));
+            if (tablebase.micro_classes[i] != i || STATE_WINNER(state) != NONE) continue;
+            if (n_free == 0 || n_free > max_cells) continue;
+            micro_boards[n_free].push_back(i);
+        }
+
+        for (u32 fields = 0; fields < (1 << 18); fields++){
+            Array<u16, 4> cells;
+            get_cells(fields, cells);
+            if (tablebase.macro_classes[fields] != fields || contains_line[cells[1]] || contains_line[cells[2]]) continue;
+            if (cells[NONE] == 0 || u32(__builtin_popcount(cells[NONE])) > max_cells) continue;
+            winners_boards.push_back(fields);
+        }
+    }
+
+    // child value for player, where WIN with fewer plies is better and
+    // LOSS with more plies is better
+    static int get_preference(u8 value){
+        int distance = TB_DISTANCE(value);
+        switch (TB_RESULT(value)){
+        case TB_WIN: return 200 - distance;
+        case TB_TIE: return 100 - distance;
+        default: return distance;
+        }
+    }
+
+    u8 evaluate(u8 forced_big_move, u8 player){
+        u8 best = 0;
+        int best_preference = -1;
+        for (u8 big_move = 0; big_move < 9; big_move++){
+            if ((winners_fields >> 2*big_move) & 3) continue;
+            if (forced_big_move != 9 && forced_big_move != big_move) continue;
+
+            u16 index = indices[big_move];
+            u16 free_cells = STATE_FREE_CELLS(micro_board_states[index]);
+            for (; free_cells; free_cells &= free_cells - 1){
+                u8 small_move = __builtin_ctz(free_cells);
+                u16 child_index = index + player*powers_of_three[small_move];
+                u32 state = micro_board_states[child_index];
+                u32 winner = STATE_WINNER(state);
+                if (winner == NONE && !STATE_FREE_CELLS(state)) winner = TIE;
+                u32 child_fields = winners_fields | winner << 2*big_move;
+
+                Array<u16, 4> cells;
+                get_cells(child_fields, cells);
+                u8 value;
+                if (contains_line[cells[player]]){
+                    value = TB_WIN | 1 << 2;
+                }else if (!cells[NONE]){
+                    value = TB_TIE | 1 << 2;
+                }else{
+                    Array<u16, 9> open_indices;
+                    u32 n_open = 0;
+                    for (u8 i = 0; i < 9; i++){
+                        if ((cells[NONE] >> i) & 1) open_indices[n_open++] = i == big_move ? child_index : indices[i];
+                    }
+                    u8 child_forced = ((cells[NONE] >> small_move) & 1) ? small_move : 9;
+                    u64 key = tablebase.get_key(child_fields, child_forced, NEXT_PLAYER(player), open_indices.data());
+                    u8 child_value;
+                    bool found = tablebase.find(key, child_value);
+                    assert(found);
+                    value = (2 - TB_RESULT(child_value)) | (TB_DISTANCE(child_value) + 1) << 2;
+                }
+
+                int preference = get_preference(value);
+                if (preference > best_preference){
+                    best_preference = preference;
+                    best = value;
+                }
+            }
+        }
+        return best;
+    }
+
+    // assigns micro boards with n_cells free cells in total to the open
+    // micro boards from big_move on and solves the positions
+    void enumerate(u8 big_move, u32 n_cells){
+        while (big_move < 9 && ((winners_fields >> 2*big_move) & 3)) big_move++;
+        if (big_move == 9){
+            if (n_cells > 0) return;
+            Array<u16, 9> open_indices;
+            u32 n_open = 0;
+            for (u8 i = 0; i < 9; i++){
+                if (!((winners_fields >> 2*i) & 3)) open_indices[n_open++] = indices[i];
+            }
+            for (u8 forced_big_move = 0; forced_big_move <= 9; forced_big_move++){
+                if (forced_big_move != 9 && ((winners_fields >> 2*forced_big_move) & 3)) continue;
+                for (u8 player = 1; player <= 2; player++){
+                    u64 key = tablebase.get_key(winners_fields, forced_big_move, player, open_indices.data());
+                    entries.push_back(key << 8 | evaluate(forced_big_move, player));
+                    n_level++;
+                }
+            }
+            return;
+        }
+
+        for (u32 n_free = 1; n_free <= n_cells && n_free < micro_boards.size(); n_free++){
+            for (u16 index : micro_boards[n_free]){
+                indices[big_move] = index;
+                enumerate(big_move + 1, n_cells - n_free);
+            }
+        }
+    }
+
+    void generate(u32 max_cells){
+        printf("cells  positions  seconds\n");
+        for (u32 n_cells = 1; n_cells <= max_cells; n_cells++){
+            Timer timer;
+            n_level = 0;
+            for (u32 fields : winners_boards){
+                winners_fields = fields;
+                enumerate(0, n_cells);
+            }
+
+            // the next level finds this one by bisection
+            std::sort(entries.begin(), entries.end());
+            tablebase.set_entries(entries.data(), entries.size());
+            tablebase.max_cells = n_cells;
+            printf("%5u %10llu %8.3f\n", n_cells, (unsigned long long)n_level, timer.stop());
+            fflush(stdout);
+        }
+    }
+};
+
+int main(int argc, char **argv){
+    const char *path = argc > 1 ? argv[1] : "tablebase.bin";
+    u32 max_cells = argc > 2 ? atoi(argv[2]) : TABLEBASE_MAX_CELLS;
+    assert(max_cells >= 1 && max_cells <= TABLEBASE_MAX_CELLS);
+
+    init();
+
+    TablebaseGenerator generator(max_cells);
+    generator.generate(max_cells);
+
+    TablebaseHeader header;
+    memcpy(header.magic, TABLEBASE_MAGIC, sizeof(header.magic));
+    header.version = TABLEBASE_VERSION;
+    header.max_cells = max_cells;
+    header.n_entries = generator.entries.size();
+
+    FILE *file = fopen(path, "wb");
+    if (!file ||
+        fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(generator.entries.data(), sizeof(u64), header.n_entries, file) != header.n_entries ||
+        fclose(file) != 0
+    ){
+        fprintf(stderr, "Failed to write %s\n", path);
+        return 1;
+    }
+    printf("%llu positions written to %s\n", (unsigned long long)header.n_entries, path);
+    return 0;
+}
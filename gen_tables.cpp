@@ -0,0 +1,47 @@
+// Writes the micro board lookup tables of common.hpp as C++ source:
+//     ./gen_tables > tables.hpp
+#define GENERATE_TABLES
+#include "common.hpp"
+
+template <typename T>
+void print_values(const T *values, u32 n){
+    printf("{");
+    for (u32 i = 0; i < n; i++){
+        if (i % 16 == 0) printf("\n   ");
+        printf(" %i,", int(values[i]));
+    }
+    printf("\n}");
+}
+
+template <typename T>
+void print_table(const char *type, const char *name, const char *size, const T *values, u32 n){
+    printf("const %s %s[%s] = ", type, name, size);
+    print_values(values, n);
+    printf(";\n\n");
+}
+
+int main(){
+    generate_tables();
+
+    printf("// Generated by gen_tables.cpp, do not edit.\n\n");
+    printf("// free cells, winner, winning cells and whether each player can still\n");
+    printf("// take the board for every micro board state\n");
+    print_table("u32", "micro_board_states", "N_MICRO_BOARDS", micro_board_states, N_MICRO_BOARDS);
+    print_table("i16", "micro_board_score", "N_MICRO_BOARDS", micro_board_score, N_MICRO_BOARDS);
+    printf("// chances of X minus chances of O to still win an undecided micro board\n");
+    print_table("i8", "micro_board_potential", "N_MICRO_BOARDS", micro_board_potential, N_MICRO_BOARDS);
+    printf("// cells which complete a line, indexed by the 9 bit set of cells of a player\n");
+    print_table("u16", "winning_cells", "1 << 9", winning_cells, 1 << 9);
+    printf("// whether a 9 bit set of cells contains a complete line\n");
+    print_table("bool", "contains_line", "1 << 9", contains_line, 1 << 9);
+
+    printf("// index of every micro board state after applying each symmetry\n");
+    printf("const u16 micro_board_symmetries[N_SYMMETRIES][N_MICRO_BOARDS] = {\n");
+    for (u8 symmetry = 0; symmetry < N_SYMMETRIES; symmetry++){
+        print_values(micro_board_symmetries[symmetry], N_MICRO_BOARDS);
+        printf(",\n");
+    }
+    printf("};\n");
+
+    return 0;
+}
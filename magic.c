@@ -4,14 +4,35 @@
 #include <ctype.h>
 #include <stdio.h>
 
-static uint32_t rd(){
-    static uint32_t x = 0x12345678;
-    x ^= x << 13;
-    x ^= x >> 17;
-    x ^= x << 5;
+#define DEFAULT_SEED 0x12345678
+
+/* Counter-based random number generator, same as Rng in util.hpp.
+   The i-th number only depends on (seed, stream, i), so each game gets its
+   own stream and results do not depend on the order games are played in. */
+struct rng {
+    uint64_t key;
+    uint64_t counter;
+};
+
+static uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
     return x;
 }
 
+static void rng_init(struct rng *rng, uint64_t seed, uint64_t stream){
+    rng->key = mix64(mix64(seed) + stream);
+    rng->counter = 0;
+}
+
+static uint32_t rd(struct rng *rng){
+    rng->counter++;
+    return mix64(rng->key + 0x9e3779b97f4a7c15ull*rng->counter) >> 32;
+}
+
 #define GET_BIT32(x, i) (((x) >> (i)) & 1)
 #define CLEAR_BIT32(x, i) x &= ~(((uint32_t)1) << i)
 
@@ -39,9 +60,9 @@ static void moves_add(struct moves *a, uint8_t macro_move, uint8_t micro_move){
     a->n++;
 }
 
-static uint8_t get_random_move(uint32_t moves){
+static uint8_t get_random_move(uint32_t moves, struct rng *rng){
     while (1){
-        uint8_t i = rd() % 9;
+        uint8_t i = rd(rng) % 9;
         if (GET_BIT32(moves, i)) return i;
     }
 }
@@ -237,87 +258,216 @@ static uint8_t make_move(struct board *board, struct moves *moves, uint8_t macro
     return 0;
 }
 
-static uint8_t make_random_move(struct board *board, struct moves *moves){
+static uint8_t make_random_move(struct board *board, struct moves *moves, struct rng *rng){
     /* choose macro board */
     uint8_t macro_move = board->forced_macro_move;
     if (macro_move == INVALID_MOVE || GET_BIT32(board->macro_moves, macro_move) == 0){
-        macro_move = get_random_move(board->macro_moves);
+        macro_move = get_random_move(board->macro_moves, rng);
     }
 
     /* choose micro board */
-    uint8_t micro_move = get_random_move(board->nine_micro_moves[macro_move]);
+    uint8_t micro_move = get_random_move(board->nine_micro_moves[macro_move], rng);
 
     return make_move(board, moves, macro_move, micro_move);
 }
 
-static uint8_t play_ultimate_tictactoe(const struct board *initial_board, struct moves *moves){
-    struct board board[1] = {*initial_board};
-
+static uint8_t play_random_game(struct board *board, struct moves *moves, struct rng *rng){
     /* while there are macro boards that can be played in */
     while (board->macro_moves){
-        uint8_t winner = make_random_move(board, moves);
+        uint8_t winner = make_random_move(board, moves, rng);
         if (winner) return winner;
     }
 
     return 0;
 }
 
+static uint8_t play_first_move(const struct board *initial_board, struct moves *moves, struct rng *rng, uint8_t macro_move, uint8_t micro_move){
+    struct board board[1] = {*initial_board};
+
+    uint8_t winner = make_move(board, moves, macro_move, micro_move);
+    if (winner) return winner;
+
+    return play_random_game(board, moves, rng);
+}
+
 #include <time.h>
+#include <math.h>
+
+/* z-value of the two-sided 99% confidence interval */
+#define CONFIDENCE_Z 2.576
+/* games per first move in the first round of successive halving, which
+   measures the speed for sizing the later rounds */
+#define MIN_GAMES_PER_ARM 100
+
+struct arm {
+    uint8_t macro_move;
+    uint8_t micro_move;
+    int wins;
+    int losses;
+};
+
+static double arm_win_rate(const struct arm *arm){
+    int total = arm->wins + arm->losses;
+    return total == 0 ? 0.5 : arm->wins / (double)total;
+}
+
+/* Wilson score interval of the win rate, which unlike the normal
+   approximation does not shrink to a point at win rates of 0 or 1 */
+static double arm_center(const struct arm *arm){
+    int total = arm->wins + arm->losses;
+    if (total == 0) return 0.5;
+    double z2 = CONFIDENCE_Z*CONFIDENCE_Z;
+    return (arm_win_rate(arm) + z2/(2.0*total))/(1.0 + z2/total);
+}
+
+/* half width of the Wilson score interval */
+static double arm_confidence(const struct arm *arm){
+    int total = arm->wins + arm->losses;
+    if (total == 0) return 0.5;
+    double p = arm_win_rate(arm);
+    double z2 = CONFIDENCE_Z*CONFIDENCE_Z;
+    return CONFIDENCE_Z/(1.0 + z2/total)*sqrt(p*(1.0 - p)/total + z2/(4.0*total*total));
+}
+
+/* whether the confidence interval of better is above that of worse */
+static int arm_separated(const struct arm *better, const struct arm *worse){
+    return arm_center(better) - arm_confidence(better) > arm_center(worse) + arm_confidence(worse);
+}
+
+static int get_first_moves(const struct board *board, struct arm *arms){
+    int n_arms = 0;
+    for (uint8_t macro_move = 0; macro_move < 9; macro_move++){
+        if (!GET_BIT32(board->macro_moves, macro_move)) continue;
+
+        /* if forced macro move is legal, it must be taken */
+        if (board->forced_macro_move != INVALID_MOVE &&
+            GET_BIT32(board->macro_moves, board->forced_macro_move) &&
+            board->forced_macro_move != macro_move) continue;
+
+        for (uint8_t micro_move = 0; micro_move < 9; micro_move++){
+            if (!GET_BIT32(board->nine_micro_moves[macro_move], micro_move)) continue;
+            struct arm arm = {macro_move, micro_move, 0, 0};
+            arms[n_arms++] = arm;
+        }
+    }
+    return n_arms;
+}
+
+static void sort_arms(struct arm **arms, int n){
+    /* insertion sort by descending win rate, there are at most 81 arms */
+    for (int i = 1; i < n; i++){
+        struct arm *arm = arms[i];
+        double p = arm_win_rate(arm);
+        int j = i;
+        for (; j > 0 && arm_win_rate(arms[j - 1]) < p; j--){
+            arms[j] = arms[j - 1];
+        }
+        arms[j] = arm;
+    }
+}
 
-static void play(const struct board *initial_board, double max_sec){
-    int counts[9][9][3];
-    memset(counts, 0, sizeof(counts));
+/* Successive halving over the legal first moves. Every round, each
+   remaining move gets the same number of random games, then the worse half
+   is dropped. The time left is split evenly over the rounds still needed
+   to get down to one move. Stops early when the best move is separated
+   from all others by the confidence intervals or when max_sec has passed.
+   Game i uses random stream i of seed. */
+static void play(const struct board *initial_board, double max_sec, uint64_t seed){
+    struct arm arms[MAX_MOVES];
+    struct arm *alive[MAX_MOVES] = {NULL};
+    int n_arms = get_first_moves(initial_board, arms);
+    int n_alive = n_arms;
     int n_games = 0;
+    int n_rounds = 0;
+    int games_per_arm = MIN_GAMES_PER_ARM;
+    int timeout = 0;
+
+    assert(n_arms > 0);
+
+    for (int i = 0; i < n_arms; i++) alive[i] = &arms[i];
 
     clock_t t = clock();
     struct moves moves[1];
+    struct rng rng[1];
+    uint8_t player = initial_board->player;
+    double dt = 0.0;
+
+    while (n_alive > 1 && !timeout){
+        for (int i = 0; i < n_alive; i++){
+            struct arm *arm = alive[i];
+            if ((clock() - t)/(double)CLOCKS_PER_SEC > max_sec){
+                /* the moves left out this round are compared with fewer games */
+                timeout = 1;
+                break;
+            }
+            for (int k = 0; k < games_per_arm; k++){
+                moves->n = 0;
+                rng_init(rng, seed, n_games + k);
+                uint8_t winner = play_first_move(initial_board, moves, rng, arm->macro_move, arm->micro_move);
 
-    while (1){
-        int n = 10*1000;
-        for (int k = 0; k < n; k++){
-            moves->n = 0;
-            uint8_t winner = play_ultimate_tictactoe(initial_board, moves);
+                if (winner == player) arm->wins++;
+                if (winner == (player ^ 3)) arm->losses++;
+            }
+            n_games += games_per_arm;
+        }
+        n_rounds++;
 
-            assert(moves->n > 0);
-            uint8_t macro_move = moves->macro_moves[0];
-            uint8_t micro_move = moves->micro_moves[0];
+        sort_arms(alive, n_alive);
 
-            counts[macro_move][micro_move][winner]++;
+        /* stop early if best move is statistically better than all others */
+        int separated = 1;
+        for (int i = 1; i < n_alive && separated; i++){
+            separated = arm_separated(alive[0], alive[i]);
         }
-        n_games += n;
-        double dt = (clock() - t)/(double)CLOCKS_PER_SEC;
-        if (dt > max_sec){
-            printf("%f million games per second\n", n_games*1e-6/dt);
-
-            printf("+-------------------+-------------------+-------------------+\n");
-            for (int macro_y = 0; macro_y < 3; macro_y++){
-                for (int micro_y = 0; micro_y < 3; micro_y++){
-                    printf("| ");
-                    for (int macro_x = 0; macro_x < 3; macro_x++){
-                        int macro_move = macro_x + macro_y*3;
-                        for (int micro_x = 0; micro_x < 3; micro_x++){
-                            int micro_move = micro_x + micro_y*3;
-                            uint8_t player = initial_board->player;
-                            int wins = counts[macro_move][micro_move][player];
-                            int losses = counts[macro_move][micro_move][player ^ 3];
-                            int total = wins + losses;
-                            if (total == 0){
-                                printf("----- ");
-                            }else{
-                                printf("%.3f ", wins / (double)total);
-                            }
-                        }
-                        printf("| ");
+        if (separated) break;
+
+        n_alive = (n_alive + 1)/2;
+
+        dt = (clock() - t)/(double)CLOCKS_PER_SEC;
+        if (n_alive == 1 || timeout || dt > max_sec) break;
+
+        int n_rounds_left = 0;
+        while ((1 << n_rounds_left) < n_alive) n_rounds_left++;
+        double games_left = n_games/dt*(max_sec - dt);
+        games_per_arm = (int)(games_left/n_rounds_left/n_alive);
+        if (games_per_arm < MIN_GAMES_PER_ARM) games_per_arm = MIN_GAMES_PER_ARM;
+    }
+
+    dt = (clock() - t)/(double)CLOCKS_PER_SEC;
+
+    if (n_games > 0) printf("%f million games per second\n", n_games*1e-6/dt);
+    printf("%i games in %i rounds, %i of %i moves remaining\n", n_games, n_rounds, n_alive, n_arms);
+    printf("best move: macro %u micro %u\n", alive[0]->macro_move, alive[0]->micro_move);
+
+    struct arm *arm_grid[9][9];
+    memset(arm_grid, 0, sizeof(arm_grid));
+    for (int i = 0; i < n_arms; i++){
+        arm_grid[arms[i].macro_move][arms[i].micro_move] = &arms[i];
+    }
+
+    /* center and half width of confidence interval of the win rate */
+    printf("+-------------------------------------+-------------------------------------+-------------------------------------+\n");
+    for (int macro_y = 0; macro_y < 3; macro_y++){
+        for (int micro_y = 0; micro_y < 3; micro_y++){
+            printf("| ");
+            for (int macro_x = 0; macro_x < 3; macro_x++){
+                int macro_move = macro_x + macro_y*3;
+                for (int micro_x = 0; micro_x < 3; micro_x++){
+                    int micro_move = micro_x + micro_y*3;
+                    struct arm *arm = arm_grid[macro_move][micro_move];
+                    if (arm == NULL || arm->wins + arm->losses == 0){
+                        printf("----------- ");
+                    }else{
+                        printf("%.3f+-%.3f ", arm_center(arm), arm_confidence(arm));
                     }
-                    printf("\n");
                 }
-                printf("+-------------------+-------------------+-------------------+\n");
+                printf("| ");
             }
             printf("\n");
-
-            break;
         }
+        printf("+-------------------------------------+-------------------------------------+-------------------------------------+\n");
     }
+    printf("\n");
 }
 
 int main(){
@@ -337,7 +487,7 @@ int main(){
     struct board board[1];
     board_init2(board, c, 1, 1);
     board_print(board);
-    play(board, 1.0);
+    play(board, 1.0, DEFAULT_SEED);
 
     return 0;
 }
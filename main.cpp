@@ -1,497 +1,493 @@
+#include "common.hpp"
+#include "mcts.hpp"
+#include "mcts_graph.hpp"
+#include "encoding.hpp"
+#include "tablebase.hpp"
+
+// playouts per second of a single search from the empty board
+void benchmark_mcts_threads(double max_sec){
+    for (u32 n_threads = 1; n_threads <= 16; n_threads *= 2){
+        MacroBoard macro_board;
+        Mcts get_mcts_move(1 << 22, max_sec, UINT_MAX, 1.4, Rng(), n_threads);
+        Timer timer;
+        get_mcts_move(macro_board, 1);
+        double dt = timer.stop();
+        printf("%2u threads: %f million playouts per second\n", n_threads, get_mcts_move.n_playouts*1e-6/dt);
+    }
+}
 
-
-
-#include "util.hpp"
-
-
-#define NONE 0
-#define TIE  3
-#define MAX_SCORE (1000*1000)
-#define MAX_MOVES (3*3*3*3)
-#define NEXT_PLAYER(player) (player ^ 3) // 0b01 <-> 0b10
-#define USE_HEURISTIC_LOOKUP_TABLE
-#define USE_WINNER_LOOOKUP_TABLE
-
-struct Move {
-    u8 big_move;
-    u8 small_move;
-};
-
-typedef SmallVector<Move, MAX_MOVES> Moves;
-typedef Array<u8, 3> ThreeMoves;
-typedef Array<u8, 9> NineMoves;
-typedef Array<int, 9> Weights;
-
-Weights default_weights{
-    3, 2, 3,
-    2, 4, 2,
-    3, 2, 3,
-};
-
-NineMoves default_move_order{4, 1, 3, 5, 7, 0, 2, 6, 8};
-
-constexpr Array<ThreeMoves, 3 + 3 + 2> wins = {
-    ThreeMoves{0, 1, 2}, // 0
-    ThreeMoves{3, 4, 5}, // 1
-    ThreeMoves{6, 7, 8}, // 2
-
-    ThreeMoves{0, 3, 6}, // 3
-    ThreeMoves{1, 4, 7}, // 4
-    ThreeMoves{2, 5, 8}, // 5
-
-    ThreeMoves{0, 4, 8}, // 6
-    ThreeMoves{2, 4, 6}, // 7
-};
-
-u8 micro_board_winner[1 << 18];
-int micro_board_score[1 << 18];
-
-template <typename BOARD>
-bool is_winner(const BOARD &board, u8 player, ThreeMoves moves){
-    for (u8 move : moves){
-        if (board.get(move) != player){
-            return false;
+// Playouts per second and strength at equal time per move
+// of light (uniformly random) and heavy playouts.
+void benchmark_playouts(int n_games){
+    Rng rng(DEFAULT_SEED);
+
+    for (int heavy = 0; heavy < 2; heavy++){
+        int n_playouts = 0;
+        Timer timer;
+        for (int i = 0; i < 100; i++){
+            // random positions after a few moves
+            MacroBoard macro_board;
+            u8 player = 1;
+            for (int j = 0; j < 10; j++){
+                macro_board.play(pick_random_move(macro_board, rng), player);
+                player = NEXT_PLAYER(player);
+            }
+            for (int j = 0; j < 1000; j++){
+                BitBoard bit_board(macro_board);
+                bit_board.playout(player, rng, NULL, heavy);
+                n_playouts++;
+            }
+        }
+        double dt = timer.stop();
+        printf("%s playouts: %f million playouts per second\n", heavy ? "heavy" : "light", n_playouts*1e-6/dt);
+    }
+
+    double max_secs[] = {0.001, 0.01, 0.1};
+    for (double max_sec : max_secs){
+        Array<int, 4> results = {};
+        for (int i = 0; i < n_games; i++){
+            Mcts light(1 << 20, max_sec, UINT_MAX, 1.4, rng.fork(2*i));
+            Mcts heavy(1 << 20, max_sec, UINT_MAX, 1.4, rng.fork(2*i + 1));
+            heavy.heavy_playouts = true;
+
+            // alternate who begins
+            u8 heavy_player = 1 + i % 2;
+            Moves moves;
+            MacroBoard macro_board;
+            u8 winner = heavy_player == 1 ?
+                get_winner(macro_board, heavy, light, 1, moves) :
+                get_winner(macro_board, light, heavy, 1, moves);
+            if (winner == TIE) results[TIE]++;
+            else results[winner == heavy_player ? 1 : 2]++;
         }
+        printf("%.3f seconds per move: heavy wins %i, light wins %i, ties %i\n", max_sec, results[1], results[2], results[TIE]);
     }
-    return true;
 }
 
-template <typename BOARD>
-bool is_winner(const BOARD &board, u8 player){
-    for (ThreeMoves moves : wins){
-        if (is_winner(board, player, moves)){
-            return true;
+// Strength at equal time per move of MCTS with alpha-beta leaf
+// evaluation against MCTS with playouts only.
+void benchmark_rollouts(int n_games, int rollout_depth){
+    Rng rng(DEFAULT_SEED);
+
+    double max_secs[] = {0.01, 0.1};
+    for (double max_sec : max_secs){
+        Array<int, 4> results = {};
+        for (int i = 0; i < n_games; i++){
+            Mcts playouts(1 << 20, max_sec, UINT_MAX, 1.4, rng.fork(2*i));
+            Mcts rollouts(1 << 20, max_sec, UINT_MAX, 1.4, rng.fork(2*i + 1));
+            rollouts.rollout_depth = rollout_depth;
+
+            // alternate who begins
+            u8 rollouts_player = 1 + i % 2;
+            Moves moves;
+            MacroBoard macro_board;
+            u8 winner = rollouts_player == 1 ?
+                get_winner(macro_board, rollouts, playouts, 1, moves) :
+                get_winner(macro_board, playouts, rollouts, 1, moves);
+            if (winner == TIE) results[TIE]++;
+            else results[winner == rollouts_player ? 1 : 2]++;
         }
+        printf("%.3f seconds per move, depth %i: rollouts win %i, playouts win %i, ties %i\n", max_sec, rollout_depth, results[1], results[2], results[TIE]);
     }
-    return false;
 }
 
-struct MicroBoard {
-    u32 fields;
-    u8 n_moves;
+// Positions per second of the network for each batch size
+// and iterations per second of MCTS with network evaluation.
+void benchmark_network(double max_sec){
+    Rng rng(DEFAULT_SEED);
+    Network network(rng);
 
-    MicroBoard(): fields(0), n_moves(9){
-        for (u8 move = 0; move < 9; move++){
-            unsafe_set(move, NONE);
+    Array<NetworkInput, NN_BATCH> inputs;
+    for (u32 i = 0; i < NN_BATCH; i++){
+        MacroBoard macro_board;
+        u8 player = 1;
+        for (int j = 0; j < 20; j++){
+            macro_board.play(pick_random_move(macro_board, rng), player);
+            player = NEXT_PLAYER(player);
+        }
+        encode(macro_board, player, inputs[i]);
+    }
+
+    for (u32 batch_size = 1; batch_size <= NN_BATCH; batch_size *= 4){
+        Array<float, NN_BATCH> values;
+        u32 n_positions = 0;
+        Timer timer;
+        double dt = 0.0;
+        while (dt < max_sec){
+            for (int i = 0; i < 100; i++){
+                network.evaluate(inputs.data(), batch_size, values.data());
+                n_positions += batch_size;
+            }
+            dt += timer.stop();
         }
+        printf("batch size %2u: %f million positions per second\n", batch_size, n_positions*1e-6/dt);
     }
 
-    void unsafe_set(u8 move, u8 player){
-        fields |= player << move*2;
-    }
+    MacroBoard macro_board;
+    Mcts get_mcts_move(1 << 22, max_sec);
+    get_mcts_move.network = &network;
+    Timer timer;
+    get_mcts_move(macro_board, 1);
+    double dt = timer.stop();
+    printf("MCTS with network: %f million iterations per second\n", get_mcts_move.n_playouts*1e-6/dt);
+}
 
-    u8 get(u8 move) const {
-        return (fields >> move*2) & 3;
-    }
+// Seconds per alpha-beta search with the heuristic and with a network
+// of random weights, after checking the incremental accumulator.
+void benchmark_nnue(int lookahead, int n_positions){
+    Rng rng(DEFAULT_SEED);
+    Nnue *nnue = new Nnue;
+    nnue->randomize(rng);
+
+    Array<MacroBoard, 100> macro_boards;
+    Array<u8, 100> players;
+    assert(n_positions <= 100);
+    for (int i = 0; i < n_positions; i++){
+        Accumulator accumulator;
+        accumulator.nnue = nnue;
+        MacroBoard macro_board;
+        macro_board.accumulator = &accumulator;
+        macro_board.refresh_accumulator();
 
-    void clr(u8 move){
-        assert(get(move) != NONE);
-        n_moves++;
-        fields &= ~(u32(3) << move*2);
-    }
+        u8 player = 1;
+        for (int j = 0; j < 20; j++){
+            macro_board.play(pick_random_move(macro_board, rng), player);
+            player = NEXT_PLAYER(player);
+        }
+        Accumulator incremental = accumulator;
+        macro_board.refresh_accumulator();
+        for (u32 k = 0; k < NNUE_HIDDEN; k++) assert(incremental.values[k] == accumulator.values[k]);
 
-    bool can_play(u8 move) const {
-        return get(move) == NONE;
+        macro_board.accumulator = NULL;
+        macro_boards[i] = macro_board;
+        players[i] = player;
     }
 
-    u8 play(u8 move, u8 player){
-        assert(can_play(move));
-        n_moves--;
-
-        unsafe_set(move, player);
-
-#ifdef USE_WINNER_LOOOKUP_TABLE
-        if (player == TIE) return n_moves == 0 ? TIE : NONE;
-
-        return micro_board_winner[fields];
-#else
-        if (player != TIE && ::is_winner(*this, player)){
-            return player;
+    for (int use_nnue = 0; use_nnue < 2; use_nnue++){
+        MacroAlphaBeta alpha_beta(lookahead);
+        if (use_nnue) alpha_beta.nnue = nnue;
+        Timer timer;
+        for (int i = 0; i < n_positions; i++){
+            alpha_beta(macro_boards[i], players[i]);
         }
-
-        return n_moves == 0 ? TIE : NONE;
-#endif
+        double dt = timer.stop();
+        printf("%s: %f seconds per search\n", use_nnue ? "nnue" : "heuristic", dt/n_positions);
     }
 
-    void print(){
-        printf("+-------+\n");
-        for (int y = 0; y < 3; y++){
-            printf("| ");
-            for (int x = 0; x < 3; x++){
-                printf("%i ", get(x + y*3));
-            }
-            printf("|\n");
+    delete nnue;
+}
+
+// Nodes per second of alpha-beta searches from random positions.
+void benchmark_alpha_beta(int lookahead, int n_positions){
+    Rng rng(DEFAULT_SEED);
+    MacroAlphaBeta alpha_beta(lookahead);
+    double dt = 0.0;
+    for (int i = 0; i < n_positions; i++){
+        MacroBoard macro_board;
+        u8 player = 1;
+        for (int j = 0; j < 20; j++){
+            macro_board.play(pick_random_move(macro_board, rng), player);
+            player = NEXT_PLAYER(player);
         }
-        printf("+-------+\n\n");
+        Timer timer;
+        alpha_beta(macro_board, player);
+        dt += timer.stop();
     }
+    printf("depth %i: %f million nodes per second\n", lookahead, alpha_beta.n_nodes*1e-6/dt);
+}
 
-    int heuristic_player(u8 player, const Weights &weights) const {
-        int score = 0;
-        for (u8 move = 0; move < 9; move++){
-            score += (get(move) == player)*weights[move];
+// Round trip every position of random games through the ranks
+// and measure the time per position.
+void benchmark_encoding(int n_games){
+    Rng rng(DEFAULT_SEED);
+    PositionRanker *ranker = new PositionRanker();
+    double rank_dt = 0.0;
+    double unrank_dt = 0.0;
+    int n_positions = 0;
+    for (int i = 0; i < n_games; i++){
+        MacroBoard macro_board;
+        u8 player = 1;
+        u8 winner = NONE;
+        while (winner == NONE){
+            Position position = to_position(macro_board, player);
+            Timer timer;
+            u128 rank = ranker->rank(position);
+            rank_dt += timer.stop();
+            Position other = ranker->unrank(rank);
+            unrank_dt += timer.stop();
+            assert(rank < ranker->n_positions);
+            assert(is_same_position(position, other));
+            assert(get_hash(to_macro_board(other), player) == get_hash(macro_board, player));
+            n_positions++;
+
+            winner = macro_board.play(pick_random_move(macro_board, rng), player);
+            player = NEXT_PLAYER(player);
         }
-        return score;
     }
+    printf("rank: %f ns, unrank: %f ns\n", rank_dt*1e9/n_positions, unrank_dt*1e9/n_positions);
+    delete ranker;
+}
 
-    int heuristic(const Weights &weights) const {
-        return heuristic_player(1, weights) - heuristic_player(2, weights);
-    }
+// Time of a tablebase probe and whether its results match a full search.
+// Needs tablebase.bin from make tablebase.bin.
+void benchmark_tablebase(int n_games){
+    Tablebase tablebase;
+    if (!tablebase.load("tablebase.bin")) return;
+    Rng rng(DEFAULT_SEED);
+    double dt = 0.0;
+    int n_probes = 0;
+    for (int i = 0; i < n_games; i++){
+        MacroBoard macro_board;
+        u8 player = 1;
+        u8 winner = NONE;
+        while (winner == NONE){
+            Timer timer;
+            u8 value;
+            bool found = tablebase.probe(macro_board, player, value);
+            dt += timer.stop();
+            n_probes++;
+            if (found){
+                MacroAlphaBeta alpha_beta(MAX_MOVES);
+                alpha_beta.set_board(macro_board);
+                int score = alpha_beta.descend(player, MAX_MOVES).value;
+                assert(TB_RESULT(value) == (score > 0 ? TB_WIN : score < 0 ? TB_LOSS : TB_TIE));
+            }
 
-    u8 update(){
-        n_moves = 0;
-        for (u8 move = 0; move < 9; move++){
-            n_moves += get(move) != NONE;
+            winner = macro_board.play(pick_random_move(macro_board, rng), player);
+            player = NEXT_PLAYER(player);
         }
-
-        u8 result = n_moves == 9 ? TIE : NONE;
-
-        if (is_winner(*this, 1)) result = 1;
-        if (is_winner(*this, 2)) result = 2;
-
-        return result;
     }
-};
-
-struct MacroBoard {
-    Array<MicroBoard, 9> micro_boards;
-    MicroBoard winners;
-    Moves moves;
-
-    bool can_play_anywhere() const {
-        // if no moves done yet
-        if (moves.empty()) return true;
+    printf("tablebase probe: %f ns\n", dt*1e9/n_probes);
+}
 
-        // if forced small board is decided already
-        return !winners.can_play(moves.back().small_move);
+// Plays random games and calls check(macro_board, player) on every position
+// before a move. If undo is set, the games are undone afterwards and check
+// is called on every position again.
+template <typename CHECK>
+void check_random_games(int n_games, bool undo, CHECK check){
+    Rng rng(DEFAULT_SEED);
+    for (int i = 0; i < n_games; i++){
+        MacroBoard macro_board;
+        u8 player = 1;
+        u8 winner = NONE;
+        while (winner == NONE){
+            check(macro_board, player);
+            winner = macro_board.play(pick_random_move(macro_board, rng), player);
+            player = NEXT_PLAYER(player);
+        }
+        while (undo && !macro_board.moves.empty()){
+            macro_board.undo();
+            player = NEXT_PLAYER(player);
+            check(macro_board, player);
+        }
     }
+}
 
-    bool can_play_big_move(u8 big_move) const {
-        // if small board is decided already, it can't be played
-        if (!winners.can_play(big_move)) return false;
-
-        if (can_play_anywhere()) return true;
-
-        return moves.back().small_move == big_move;
+// ternary index of the cells, computed from scratch
+u16 get_index(const MicroBoard &micro_board){
+    u16 index = 0;
+    for (u8 move = 0; move < 9; move++){
+        index += MicroBoard::get_digit(micro_board.get(move))*powers_of_three[move];
     }
+    return index;
+}
 
-    bool can_play(Move move) const {
-
-        if (!can_play_big_move(move.big_move)) return false;
-
-        // small field to play must still be empty
-        if (!micro_boards[move.big_move].can_play(move.small_move)) return false;
+// Every state round trips through its ternary index, and the indices of
+// random games stay in sync with the fields while playing and undoing.
+void test_micro_board_index(int n_games){
+    for (u32 i = 0; i < N_MICRO_BOARDS; i++){
+        MicroBoard micro_board = MicroBoard::from_index(i);
+        assert(micro_board.index == i);
+        assert(get_index(micro_board) == i);
+    }
+    check_random_games(n_games, true, [](const MacroBoard &macro_board, u8){
+        for (const MicroBoard &micro_board : macro_board.micro_boards){
+            assert(micro_board.index == get_index(micro_board));
+        }
+        assert(macro_board.winners.index == get_index(macro_board.winners));
+    });
+    printf("micro board index: %i games ok\n", n_games);
+}
 
-        return true;
+// free cells of a 3x3 board which complete a line of player, by trying all
+u16 get_winning_cells_brute_force(const MicroBoard &board, u8 player){
+    u16 cells = 0;
+    for (u8 move = 0; move < 9; move++){
+        if (board.get(move) != NONE) continue;
+        MicroBoard copy = board;
+        copy.unsafe_set(move, player);
+        if (is_winner(copy, player)) cells |= 1 << move;
     }
+    return cells;
+}
 
-    void undo(){
-        assert(!moves.empty());
-        Move move = moves.back();
-        if (winners.get(move.big_move) != NONE){
-            winners.clr(move.big_move);
+// The winning cells of every undecided micro board state and the winning
+// boards of random games match trying every free cell.
+void test_winning_cells(int n_games){
+    for (u32 i = 0; i < N_MICRO_BOARDS; i++){
+        MicroBoard micro_board = MicroBoard::from_index(i);
+        if (STATE_WINNER(micro_board_states[i]) != NONE) continue;
+        for (u8 player = 1; player <= 2; player++){
+            assert(micro_board.get_winning_cells(player) == get_winning_cells_brute_force(micro_board, player));
         }
-        micro_boards[move.big_move].clr(move.small_move);
-        moves.pop_back();
     }
-
-    u8 play(Move move, u8 player){
-        if (!can_play(move)){
-            printf("ERROR: player %u wants to play invalid move (%u, %u)\n", player, move.big_move, move.small_move);
-            print();
-            assert(can_play(move));
+    check_random_games(n_games, false, [](const MacroBoard &macro_board, u8){
+        for (u8 player = 1; player <= 2; player++){
+            assert(macro_board.get_winning_boards(player) == get_winning_cells_brute_force(macro_board.winners, player));
         }
+    });
+    printf("winning cells: %i games ok\n", n_games);
+}
 
-        moves.push_back(move);
-
-        u8 winner = micro_boards[move.big_move].play(move.small_move, player);
-        if (winner != NONE){
-            winner = winners.play(move.big_move, winner);
+// whether player can still complete a macro line, where every undecided
+// micro board of the line needs a line without cells of the opponent
+bool can_still_win(const MacroBoard &macro_board, u8 player){
+    u8 opponent = NEXT_PLAYER(player);
+    for (ThreeMoves big_line : wins){
+        bool open = true;
+        for (u8 big_move : big_line){
+            u8 winner = macro_board.winners.get(big_move);
+            if (winner == player) continue;
             if (winner != NONE){
-                return winner;
+                open = false;
+                break;
             }
-        }
-
-        return NONE;
-    }
-/*
-    void print(){
-        for (int i = 0; i < 3; i++) printf("+-------");
-        printf("+\n");
-
-        for (int y = 0; y < 3; y++){
-            for (int i = 0; i < 3; i++){
-                printf("| ");
-                for (int x = 0; x < 3; x++){
-                    const MicroBoard &micro_board = micro_boards[x + y*3];
-                    u8 a = micro_board.get(0 + i*3);
-                    u8 b = micro_board.get(1 + i*3);
-                    u8 c = micro_board.get(2 + i*3);
-                    printf("%i %i %i | ", a, b, c);
-                }
-                printf("\n");
-            }
-
-            for (int i = 0; i < 3; i++) printf("+-------");
-            printf("+\n");
-        }
-        winners.print();
-        printf("\n\n");
-    }
-*/
-    static char translate(u8 player){
-        assert(player < 3);
-        switch (player){
-        case NONE: return '-';
-        case 1: return 'X';
-        case 2: return 'O';
-        default: return '?';
-        }
-    }
-
-    void print(){
-        for (int y = 0; y < 3; y++){
-            for (int i = 0; i < 3; i++){
-                for (int x = 0; x < 3; x++){
-                    const MicroBoard &micro_board = micro_boards[x + y*3];
-                    u8 a = micro_board.get(0 + i*3);
-                    u8 b = micro_board.get(1 + i*3);
-                    u8 c = micro_board.get(2 + i*3);
-                    printf("%c%c%c", translate(a), translate(b), translate(c));
-                }
-                printf("\n");
+            const MicroBoard &micro_board = macro_board.micro_boards[big_move];
+            bool can_take = false;
+            for (ThreeMoves line : wins){
+                bool free = true;
+                for (u8 move : line) free &= micro_board.get(move) != opponent;
+                can_take |= free;
             }
+            open &= can_take;
         }
+        if (open) return true;
     }
-};
-
-Move get_random_move(const MacroBoard &macro_board, u8 player){
-    UNUSED(player);
-
-    Moves moves;
-    for (u8 big_move = 0; big_move < 9; big_move++){
-        if (!macro_board.can_play_big_move(big_move)) continue;
-        const MicroBoard &micro_board = macro_board.micro_boards[big_move];
-        for (u8 small_move = 0; small_move < 9; small_move++){
-            if (!micro_board.can_play(small_move)) continue;
-            Move move{big_move, small_move};
-            moves.push_back(move);
-        }
-    }
-
-    assert(moves.size() > 0);
-
-    return moves[rd() % moves.size()];
+    return false;
 }
 
-template <typename GET_MOVE_PLAYER1, typename GET_MOVE_PLAYER2>
-u8 get_winner(MacroBoard &macro_board, GET_MOVE_PLAYER1 &get_move_player1, GET_MOVE_PLAYER2 &get_move_player2, u8 player, Moves &moves){
-    for (int round = 0; round < MAX_MOVES; round++){
-
-        Move move;
-        if (player == 1){
-            move = get_move_player1(macro_board, player);
-        }else{
-            move = get_move_player2(macro_board, player);
-        }
-        moves.push_back(move);
-
-        u8 winner = macro_board.play(move, player);
-
-        if (winner != NONE){
-            return winner;
+// Dead draws of random games match checking every line, while playing and
+// undoing, and random games from them end in ties.
+void test_dead_draw(int n_games){
+    Rng rng(DEFAULT_SEED + 1);
+    int n_dead_draws = 0;
+    check_random_games(n_games, true, [&](const MacroBoard &macro_board, u8 player){
+        bool is_dead_draw = !can_still_win(macro_board, 1) && !can_still_win(macro_board, 2);
+        assert(macro_board.is_dead_draw() == is_dead_draw);
+        if (!is_dead_draw) return;
+        n_dead_draws++;
+        MacroBoard copy = macro_board;
+        u8 winner = NONE;
+        while (winner == NONE){
+            winner = copy.play(pick_random_move(copy, rng), player);
+            player = NEXT_PLAYER(player);
         }
+        assert(winner == TIE);
+    });
+    printf("dead draw: %i games, %i dead draws ok\n", n_games, n_dead_draws);
+}
 
-        player = NEXT_PLAYER(player);
+// same cells and forced micro board
+bool is_same_board(const MacroBoard &a, const MacroBoard &b){
+    if (get_forced_big_move(a) != get_forced_big_move(b)) return false;
+    if (a.winners.fields != b.winners.fields) return false;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        if (a.micro_boards[big_move].fields != b.micro_boards[big_move].fields) return false;
     }
-
-    return TIE;
+    return true;
 }
 
-struct MacroScore {
-    int value;
-    Moves moves;
-};
-
-struct MacroAlphaBeta {
-    MacroBoard macro_board;
-
-    int lookahead;
-    Weights weights;
-    NineMoves move_order;
-
-    MacroAlphaBeta(
-        int lookahead,
-        const Weights &weights = default_weights,
-        const NineMoves &move_order = default_move_order
-    ):
-        lookahead(lookahead),
-        weights(weights),
-        move_order(move_order)
-    {}
-
-    MacroScore descend(u8 player, int depth, int alpha = -MAX_SCORE, int beta = +MAX_SCORE){
-        u8 opponent = NEXT_PLAYER(player);
-
-        if (depth == 0){
-#ifdef USE_HEURISTIC_LOOKUP_TABLE
-            int score = micro_board_score[macro_board.winners.fields];
-#else
-            int score = macro_board.winners.heuristic(weights);
-#endif
-            if (player == 2) score = -score;
-            return MacroScore{score, macro_board.moves};
+// At every position of random games and for every symmetry, transform
+// matches replaying the transformed moves, symmetric positions have the
+// same canonical hash and the stabilizer matches comparing the boards.
+// The moves which are not redundant lead to one child of every class.
+void test_symmetries(int n_games){
+    check_random_games(n_games, false, [](const MacroBoard &macro_board, u8 player){
+        u64 canonical_hash = get_canonical_hash(macro_board, player);
+        SymmetryKey canonical_key = get_symmetry_key(macro_board, get_canonical_symmetry(macro_board));
+        u8 stabilizer = get_stabilizer(macro_board);
+        for (u8 symmetry = 0; symmetry < N_SYMMETRIES; symmetry++){
+            const NineMoves &permutation = symmetries[symmetry];
+            MacroBoard replay;
+            u8 p = 1;
+            for (Move move : macro_board.moves){
+                replay.play(Move{permutation[move.big_move], permutation[move.small_move]}, p);
+                p = NEXT_PLAYER(p);
+            }
+            MacroBoard transformed = transform(macro_board, symmetry);
+            assert(is_same_board(replay, transformed));
+            assert(get_canonical_hash(replay, player) == canonical_hash);
+            assert(!is_less(get_symmetry_key(macro_board, symmetry), canonical_key));
+            assert(((stabilizer >> symmetry) & 1) == is_same_board(transformed, macro_board));
         }
 
-        MacroScore best_score;
-        bool no_score = true;
-
-        for (u8 big_move : move_order){
+        std::vector<u64> children;
+        std::vector<u64> kept_children;
+        for (u8 big_move = 0; big_move < 9; big_move++){
             if (!macro_board.can_play_big_move(big_move)) continue;
-            const MicroBoard &micro_board = macro_board.micro_boards[big_move];
-            for (u8 small_move : move_order){
-                if (!micro_board.can_play(small_move)) continue;
+            for (u8 small_move = 0; small_move < 9; small_move++){
                 Move move{big_move, small_move};
-
-                u8 winner = macro_board.play(move, player);
-
-                MacroScore new_score;
-
-                if (winner == NONE){
-                    new_score = descend(opponent, depth - 1, -beta, -alpha);
-                    new_score.value = -new_score.value;
-                }else if (winner == TIE){
-                    new_score = MacroScore{0, macro_board.moves};
-                }else{
-                    int score = (player == winner) ? +MAX_SCORE : -MAX_SCORE;
-                    new_score = MacroScore{score, macro_board.moves};
-                }
-
-                macro_board.undo();
-
-                if (no_score || best_score.value < new_score.value){
-                    no_score = false;
-                    best_score = new_score;
-                }
-                if (alpha < best_score.value) alpha = best_score.value;
-                if (beta <= alpha) return best_score;
+                if (!macro_board.can_play(move)) continue;
+                MacroBoard child = macro_board;
+                child.play(move, player);
+                u64 hash = get_canonical_hash(child, NEXT_PLAYER(player));
+                children.push_back(hash);
+                if (!is_redundant_move(move, stabilizer)) kept_children.push_back(hash);
             }
         }
-
-        // there must have been a living branch because game did not tie yet
-        assert(!no_score);
-
-        return best_score;
-    }
-
-    Move operator () (const MacroBoard &macro_board, u8 player){
-        this->macro_board = macro_board;
-
-#if 1
-        // discard all previous moves except the last one for faster copying
-        if (!macro_board.moves.empty()){
-            auto &moves = this->macro_board.moves;
-            Move last_move = moves.back();
-            moves.clear();
-            moves.push_back(last_move);
-        }
-#endif
-
-        MacroScore score = descend(player, lookahead);
-
-#if 1
-        assert(!score.moves.empty());
-        return score.moves[macro_board.moves.empty() ? 0 : 1];
-#else
-        assert(score.moves.size() > macro_board.moves.size());
-        return score.moves[macro_board.moves.size()];
-#endif
-    }
-};
-
-MacroBoard from_buffer(const Array<char, MAX_MOVES> &buffer, int x0, int y0){
-    MacroBoard macro_board;
-    int k = 0;
-    if (x0 != -1 && y0 != -1){
-        macro_board.moves.push_back(Move{66, u8(x0 + y0*3)});
-    }
-    for (int y = 0; y < 3; y++){
-        for (int i = 0; i < 3; i++){
-            for (int x = 0; x < 3; x++){
-                for (int j = 0; j < 3; j++){
-                    u8 move = i*3 + j;
-                    char c = buffer[k++];
-                    if (c == '-') continue;
-                    if (c != 'X' && c != 'O'){
-                        fprintf(stderr, "Invalid character: %c\n", c);
-                        assert("Invalid character");
-                    }
-                    u8 player = c == 'X' ? 1 : 2;
-                    macro_board.micro_boards[x + y*3].unsafe_set(move, player);
-                }
-            }
-        }
-    }
-    for (u8 move = 0; move < 9; move++){
-        u8 player = macro_board.micro_boards[move].update();
-        if (player == NONE) continue;
-        macro_board.winners.play(move, player);
-    }
-    return macro_board;
+        std::sort(children.begin(), children.end());
+        children.erase(std::unique(children.begin(), children.end()), children.end());
+        std::sort(kept_children.begin(), kept_children.end());
+        assert(std::unique(kept_children.begin(), kept_children.end()) == kept_children.end());
+        assert(kept_children == children);
+    });
+    printf("symmetries: %i games ok\n", n_games);
 }
 
-void init(){
-    MicroBoard micro_board;
-    for (u32 i = 0; i < (1 << 18); i++){
-        micro_board.fields = i;
-#ifdef USE_WINNER_LOOOKUP_TABLE
-        micro_board_winner[i] = micro_board.update();
-#endif
+// Self-play with few playouts per move, so that the searches often reuse
+// subtrees whose root is proven already, like a dead draw.
+void test_mcts_reuse(int n_games){
+    Rng rng(DEFAULT_SEED);
+    for (int i = 0; i < n_games; i++){
+        Mcts mcts1(1 << 16, 100.0, 200, 1.4, rng.fork(4*i));
+        Mcts mcts2(1 << 16, 100.0, 200, 1.4, rng.fork(4*i + 1));
+        Moves moves;
+        MacroBoard macro_board;
+        get_winner(macro_board, mcts1, mcts2, 1, moves);
 
-#ifdef USE_HEURISTIC_LOOKUP_TABLE
-        micro_board_score[i] = micro_board.heuristic(default_weights);
-#endif
+        MctsGraph graph1(1 << 16, 100.0, 200, 1.4, rng.fork(4*i + 2));
+        MctsGraph graph2(1 << 16, 100.0, 200, 1.4, rng.fork(4*i + 3));
+        Moves graph_moves;
+        MacroBoard graph_board;
+        get_winner(graph_board, graph1, graph2, 1, graph_moves);
     }
+    printf("mcts reuse: %i games ok\n", n_games);
 }
 
-Move get_probable_move(const MacroBoard &macro_board0, u8 player){
-    Array<Array<int, 9>, 9> scores = {};
-    Array<Array<int, 9>, 9> counts = {};
-
-    for (int i = 0; i < 100*1000; i++){
-        MacroBoard macro_board = macro_board0;
-        Moves moves;
-        u8 winner = get_winner(macro_board, get_random_move, get_random_move, player, moves);
-        Move first_move = moves[0];
-        counts[first_move.big_move][first_move.small_move]++;
-        if (winner == player){
-            scores[first_move.big_move][first_move.small_move] += 1;
-        }
-        if (winner != player){
-            scores[first_move.big_move][first_move.small_move] -= 1;
-        }
-    }
-
-    int max_score = INT_MIN;
-    bool no_move = true;
-    Move move;
+// ./main test runs the checks instead of the games
+int main(int argc, char **argv){
+    init();
 
-    for (u8 big_move = 0; big_move < 9; big_move++){
-        for (u8 small_move = 0; small_move < 9; small_move++){
-            if (counts[big_move][small_move] == 0) continue;
-            int score = scores[big_move][small_move];
-            if (no_move || max_score < score){
-                max_score = score;
-                no_move = false;
-                move = Move{big_move, small_move};
-            }
-        }
+    if (argc > 1 && strcmp(argv[1], "test") == 0){
+        test_micro_board_index(1000);
+        test_winning_cells(1000);
+        test_dead_draw(1000);
+        test_symmetries(200);
+        test_mcts_reuse(20);
+        return 0;
     }
 
-    return move;
-}
-
-int main(){
-    init();
+#if 0
+    benchmark_mcts_threads(1.0);
+    benchmark_playouts(100);
+    benchmark_rollouts(100, 2);
+    benchmark_rollouts(100, 3);
+    benchmark_network(1.0);
+    benchmark_nnue(6, 100);
+    benchmark_alpha_beta(7, 100);
+    benchmark_encoding(1000);
+    benchmark_tablebase(1000);
+#endif
 
     for (int i = 0; i < 10; i++){
         Moves moves;
@@ -501,6 +497,17 @@ int main(){
         u8 winner = get_winner(macro_board, get_probable_move, get_smart_move, 1, moves);
         printf("winner: %u\n", winner);
     }
+
+#if 0
+    for (int i = 0; i < 10; i++){
+        Moves moves;
+        MacroBoard macro_board;
+        Mcts get_mcts_move(1 << 20, 0.1);
+        MacroAlphaBeta get_smart_move(6);
+        u8 winner = get_winner(macro_board, get_mcts_move, get_smart_move, 1, moves);
+        printf("mcts winner: %u\n", winner);
+    }
+#endif
 #if 0
     {
 
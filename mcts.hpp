@@ -0,0 +1,654 @@
+#pragma once
+
+#include <math.h>
+#include <thread>
+
+#include "common.hpp"
+#include "bitboard.hpp"
+#include "network.hpp"
+#include "timer.hpp"
+
+#define NO_CHILDREN 0xffffffff
+#define EXPANDING   0xfffffffe
+#define MAX_THREADS 64
+
+#define ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define ATOMIC_ADD(x, n) __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+
+// Points for the player who made the move into a node,
+// so that a win is worth 64, a tie 32 and a loss 0.
+// Leaf evaluations by alpha-beta score anything in between.
+#define WIN_POINTS 64
+
+// Nodes are shared by all search threads. Counters are updated atomically
+// and children are published by storing first_child last.
+struct MctsNode {
+    u32 first_child; // index of first child in arena, children are contiguous
+    u32 visits;
+    u32 points;      // sum of points for the player who made the move
+    u32 amaf_visits; // playouts through the parent where the move was played later
+    u32 amaf_points;
+    Move move;       // move which lead to this node
+    u8 n_children;
+    u8 winner;       // winner with perfect play if proven, NONE otherwise
+
+    bool is_expanded() const {
+        return __atomic_load_n(&first_child, __ATOMIC_ACQUIRE) < EXPANDING;
+    }
+
+    // proven nodes are either terminal or all their children are proven
+    bool is_proven() const {
+        return get_winner() != NONE;
+    }
+
+    u8 get_winner() const {
+        return __atomic_load_n(&winner, __ATOMIC_RELAXED);
+    }
+};
+
+bool is_same_position(const MacroBoard &a, const MacroBoard &b){
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        if (a.micro_boards[big_move].fields != b.micro_boards[big_move].fields) return false;
+    }
+    return get_forced_big_move(a) == get_forced_big_move(b);
+}
+
+// leaf waiting for its batch to be evaluated
+struct PendingLeaf {
+    SmallVector<u32, MAX_MOVES + 1> path;
+    u8 player; // player who made the move into the leaf
+};
+
+u8 get_points(u8 winner, u8 player){
+    if (winner == TIE) return WIN_POINTS/2;
+    return winner == player ? WIN_POINTS : 0;
+}
+
+// Calls add(move, winner, board) for every move of player which a search
+// expands, with the result of play_or_draw and the board after the move.
+// Symmetric moves at the root lead to equivalent positions, so only one of
+// each is added there. Below the root symmetries are rare. Returns false
+// as soon as add does.
+template <typename ADD>
+bool for_each_search_move(const MacroBoard &macro_board, u8 player, bool is_root, ADD add){
+    MacroBoard board = macro_board;
+    u8 stabilizer = is_root ? get_stabilizer(board) : 1;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        if (!board.can_play_big_move(big_move)) continue;
+        for (u8 small_move = 0; small_move < 9; small_move++){
+            if (!board.micro_boards[big_move].can_play(small_move)) continue;
+            Move move{big_move, small_move};
+            if (is_redundant_move(move, stabilizer)) continue;
+            u8 winner = board.play_or_draw(move, player);
+            bool ok = add(move, winner, board);
+            board.undo();
+            if (!ok) return false;
+        }
+    }
+    return true;
+}
+
+// Runs searcher->search on n_threads threads. Every thread of every search
+// has its own random number stream.
+template <typename SEARCHER>
+void run_search_threads(SEARCHER *searcher, u32 n_threads, const Rng &rng, u32 n_searches, const Timer &timer){
+    if (n_threads == 1){
+        searcher->search(rng.fork(n_searches*MAX_THREADS), timer);
+        return;
+    }
+    Array<std::thread, MAX_THREADS> threads;
+    for (u32 i = 0; i < n_threads; i++){
+        Rng thread_rng = rng.fork(n_searches*MAX_THREADS + i);
+        threads[i] = std::thread(&SEARCHER::search, searcher, thread_rng, timer);
+    }
+    for (u32 i = 0; i < n_threads; i++){
+        threads[i].join();
+    }
+}
+
+// UCT Monte Carlo tree search.
+// All nodes live in an arena which is allocated once, so searching does not
+// allocate memory. The subtree of the previous search is reused if the new
+// position is reachable from it and everything else is recycled. If the
+// arena runs full during a search, the threads stop, the subtrees below
+// the least visited nodes are cut and the search goes on.
+// Several threads can search the same tree. A thread adds virtual losses to
+// the nodes on its path so that other threads prefer different paths.
+// Game results are propagated up the tree with minimax rules (MCTS-Solver),
+// so proven subtrees are not searched any further.
+// With rave_equivalence > 0, every playout also updates the all-moves-as-first
+// statistics of each move which was played later in the playout by the same
+// player. Those are blended into the mean with weight
+// sqrt(rave_equivalence/(3*visits + rave_equivalence)).
+// With rollout_depth > 0, leaves of positions where at least
+// rollout_min_decided micro boards are decided are evaluated by a shallow
+// alpha-beta search instead of a playout. Earlier, the heuristic sees too
+// little of the macro board and playouts are the better estimate.
+// With a network, each thread collects batch_size leaves, keeping virtual
+// losses on their paths, and evaluates them together.
+struct Mcts {
+    MctsNode *nodes;
+    u32 *forward; // scratch space to compact the arena
+    u32 capacity;
+    u32 n_nodes;
+
+    u32 root;
+    MacroBoard root_board;
+    u8 root_player;
+
+    double max_sec;
+    u32 max_playouts;
+    double exploration;
+    Rng rng;
+    u32 n_threads;
+    u32 virtual_loss;
+    double rave_equivalence;
+    bool heavy_playouts; // playouts with simple tactics instead of random moves
+    int rollout_depth;      // depth of alpha-beta leaf evaluation, 0 for playouts only
+    u8 rollout_min_decided; // decided micro boards before alpha-beta is used
+    double rollout_scale;   // heuristic score difference of about one logit
+    const Network *network; // evaluates leaves in batches instead of playouts if set
+    const Tablebase *tablebase; // ends playouts early with exact results if set
+    u32 batch_size;         // leaves per batch, at most NN_BATCH
+
+    u32 n_playouts;
+    u32 n_searches;
+
+    Mcts(
+        u32 capacity,
+        double max_sec,
+        u32 max_playouts = UINT_MAX,
+        double exploration = 1.4,
+        const Rng &rng = Rng(),
+        u32 n_threads = 1,
+        u32 virtual_loss = 1,
+        double rave_equivalence = 0.0
+    ):
+        nodes(new MctsNode[capacity]),
+        forward(new u32[capacity]),
+        capacity(capacity),
+        n_nodes(0),
+        root(0),
+        root_player(NONE),
+        max_sec(max_sec),
+        max_playouts(max_playouts),
+        exploration(exploration),
+        rng(rng),
+        n_threads(n_threads),
+        virtual_loss(virtual_loss),
+        rave_equivalence(rave_equivalence),
+        heavy_playouts(false),
+        rollout_depth(0),
+        rollout_min_decided(6),
+        rollout_scale(4.0),
+        network(NULL),
+        tablebase(NULL),
+        batch_size(NN_BATCH),
+        n_playouts(0),
+        n_searches(0)
+    {
+        assert(capacity > MAX_MOVES);
+        assert(n_threads > 0 && n_threads <= MAX_THREADS);
+    }
+
+    ~Mcts(){
+        delete[] nodes;
+        delete[] forward;
+    }
+
+    Mcts(const Mcts&) = delete;
+    Mcts& operator = (const Mcts&) = delete;
+
+    void reset(const MacroBoard &macro_board, u8 player){
+        n_nodes = 1;
+        root = 0;
+        nodes[root] = MctsNode{NO_CHILDREN, 0, 0, 0, 0, Move{66, 66}, 0, NONE};
+        root_board = macro_board;
+        root_player = player;
+    }
+
+    // Keep only the subtree below new_root and slide it to the front of the
+    // arena. Children are always allocated after their parent, so nodes can
+    // be moved in order of increasing index without overwriting live nodes.
+    void compact(u32 new_root){
+        // threads might have reserved more than fits if the arena ran full
+        if (n_nodes > capacity) n_nodes = capacity;
+
+        for (u32 i = 0; i < n_nodes; i++) forward[i] = NO_CHILDREN;
+
+        // mark live nodes, every child block starts behind its parent
+        forward[new_root] = 0;
+        for (u32 i = new_root; i < n_nodes; i++){
+            if (forward[i] == NO_CHILDREN) continue;
+            const MctsNode &node = nodes[i];
+            if (!node.is_expanded()) continue;
+            for (u32 j = 0; j < node.n_children; j++){
+                forward[node.first_child + j] = 0;
+            }
+        }
+
+        u32 n = 0;
+        for (u32 i = new_root; i < n_nodes; i++){
+            if (forward[i] == NO_CHILDREN) continue;
+            forward[i] = n++;
+        }
+
+        for (u32 i = new_root; i < n_nodes; i++){
+            if (forward[i] == NO_CHILDREN) continue;
+            MctsNode node = nodes[i];
+            if (node.is_expanded()) node.first_child = forward[node.first_child];
+            nodes[forward[i]] = node;
+        }
+
+        n_nodes = n;
+        root = 0;
+    }
+
+    // try to find macro_board in the tree of the previous search
+    bool reuse(const MacroBoard &macro_board, u8 player){
+        if (n_nodes == 0) return false;
+
+        if (player == root_player && is_same_position(root_board, macro_board)){
+            compact(root);
+            return true;
+        }
+
+        // position might be the reply to the move chosen by the previous search
+        if (player == root_player || !nodes[root].is_expanded()) return false;
+
+        const MctsNode &node = nodes[root];
+        for (u32 i = node.first_child; i < node.first_child + node.n_children; i++){
+            MacroBoard board = root_board;
+            board.play(nodes[i].move, root_player);
+            if (!is_same_position(board, macro_board)) continue;
+
+            root_board = board;
+            root_player = player;
+            compact(i);
+            return true;
+        }
+
+        return false;
+    }
+
+    // Allocate one child per legal move. Returns false if the arena is full
+    // or if another thread is expanding the node already.
+    bool expand(u32 index, const MacroBoard &macro_board, u8 player){
+        if (ATOMIC_LOAD(n_nodes) + MAX_MOVES > capacity) return false;
+
+        MctsNode &node = nodes[index];
+        u32 expected = NO_CHILDREN;
+        if (!__atomic_compare_exchange_n(&node.first_child, &expected, EXPANDING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            return false;
+        }
+
+        SmallVector<MctsNode, MAX_MOVES> children;
+        for_each_search_move(macro_board, player, index == root, [&](Move move, u8 winner, const MacroBoard&){
+            children.push_back(MctsNode{NO_CHILDREN, 0, 0, 0, 0, move, 0, winner});
+            return true;
+        });
+
+        assert(children.size() > 0);
+
+        u32 first_child = ATOMIC_ADD(n_nodes, children.size());
+        if (first_child + children.size() > capacity){
+            __atomic_store_n(&node.first_child, NO_CHILDREN, __ATOMIC_RELEASE);
+            return false;
+        }
+
+        for (u32 i = 0; i < children.size(); i++){
+            nodes[first_child + i] = children[i];
+        }
+        node.n_children = children.size();
+
+        // publish children
+        __atomic_store_n(&node.first_child, first_child, __ATOMIC_RELEASE);
+
+        return true;
+    }
+
+    u32 select(u32 index){
+        const MctsNode &node = nodes[index];
+        u32 first_child = __atomic_load_n(&node.first_child, __ATOMIC_ACQUIRE);
+        double log_visits = log(ATOMIC_LOAD(node.visits) + 1);
+
+        u32 best_child = first_child;
+        double best_value = -INF;
+
+        for (u32 i = first_child; i < first_child + node.n_children; i++){
+            const MctsNode &child = nodes[i];
+            // nothing left to learn about proven children
+            if (child.is_proven()) continue;
+
+            u32 visits = ATOMIC_LOAD(child.visits);
+            if (visits == 0) return i;
+
+            double mean = ATOMIC_LOAD(child.points)/(double)(WIN_POINTS*visits);
+
+            u32 amaf_visits = ATOMIC_LOAD(child.amaf_visits);
+            if (rave_equivalence > 0.0 && amaf_visits > 0){
+                double amaf_mean = ATOMIC_LOAD(child.amaf_points)/(double)(WIN_POINTS*amaf_visits);
+                double beta = sqrt(rave_equivalence/(3.0*visits + rave_equivalence));
+                mean = (1.0 - beta)*mean + beta*amaf_mean;
+            }
+
+            double value = mean + exploration*sqrt(log_visits/visits);
+            if (value > best_value){
+                best_value = value;
+                best_child = i;
+            }
+        }
+
+        return best_child;
+    }
+
+    u8 playout(const MacroBoard &macro_board, u8 player, Rng &rng, Array<CellSet, 2> *played){
+        BitBoard bit_board(macro_board);
+        return bit_board.playout(player, rng, played, heavy_playouts, tablebase);
+    }
+
+    bool use_alpha_beta(const MacroBoard &macro_board) const {
+        return rollout_depth > 0 && 9 - macro_board.winners.n_moves >= rollout_min_decided;
+    }
+
+    // Points for player to move, estimated by a shallow alpha-beta search.
+    // The score is squashed into a winning probability by a logistic curve.
+    u8 evaluate(MacroAlphaBeta &alpha_beta, const MacroBoard &macro_board, u8 player){
+        alpha_beta.set_board(macro_board);
+        int score = alpha_beta.descend(player, rollout_depth).value;
+        if (score >= +MAX_SCORE) return WIN_POINTS;
+        if (score <= -MAX_SCORE) return 0;
+
+        double p = 1.0/(1.0 + exp(-score/rollout_scale));
+        return (u8)(p*WIN_POINTS + 0.5);
+    }
+
+    // Walk from the root to a leaf, adding virtual losses on the way. A leaf
+    // which was visited before is expanded and one of its children becomes
+    // the leaf. Returns the winner if the leaf is proven, NONE otherwise.
+    u8 descend(SmallVector<u32, MAX_MOVES + 1> &path, MacroBoard &macro_board, u8 &player){
+        u32 index = root;
+        path.push_back(index);
+        ATOMIC_ADD(nodes[index].visits, virtual_loss);
+
+        while (nodes[index].is_expanded() && !nodes[index].is_proven()){
+            index = select(index);
+            macro_board.play(nodes[index].move, player);
+            player = NEXT_PLAYER(player);
+            path.push_back(index);
+            ATOMIC_ADD(nodes[index].visits, virtual_loss);
+        }
+
+        u8 winner = nodes[index].get_winner();
+        bool proven = winner != NONE;
+        bool expanded = false;
+
+        if (winner == NONE){
+            // expand on second visit, root is always expanded
+            bool visited = ATOMIC_LOAD(nodes[index].visits) > virtual_loss;
+            if ((visited || index == root) && expand(index, macro_board, player)){
+                expanded = true;
+                index = select(index);
+                winner = macro_board.play_or_draw(nodes[index].move, player);
+                player = NEXT_PLAYER(player);
+                path.push_back(index);
+                ATOMIC_ADD(nodes[index].visits, virtual_loss);
+                proven = winner != NONE;
+            }
+        }
+
+        // a new child or proven leaf might prove its ancestors
+        if (proven || expanded){
+            u8 parent_player = NEXT_PLAYER(player);
+            for (u32 i = path.size() - 1; i-- > 0;){
+                if (!prove(path[i], parent_player)) break;
+                parent_player = NEXT_PLAYER(parent_player);
+            }
+        }
+
+        return winner;
+    }
+
+    // Replace virtual losses on path by the result. The player made the move
+    // into the last node and scored points there.
+    void backup(const SmallVector<u32, MAX_MOVES + 1> &path, u8 player, u8 points, Array<CellSet, 2> &played){
+        for (u32 i = path.size(); i-- > 0;){
+            MctsNode &node = nodes[path[i]];
+            ATOMIC_ADD(node.visits, 1 - virtual_loss);
+            ATOMIC_ADD(node.points, points);
+
+            // moves of node are played by the opponent of player
+            u8 opponent = NEXT_PLAYER(player);
+            if (rave_equivalence > 0.0 && i + 1 < path.size()){
+                update_amaf(path[i], played[opponent - 1], WIN_POINTS - points);
+            }
+
+            // the move into this node was played by player
+            if (i > 0) played[player - 1].insert(node.move.big_move, node.move.small_move);
+
+            player = NEXT_PLAYER(player);
+            points = WIN_POINTS - points;
+        }
+    }
+
+    void iterate(Rng &rng, MacroAlphaBeta &alpha_beta){
+        SmallVector<u32, MAX_MOVES + 1> path;
+        Array<CellSet, 2> played;
+        MacroBoard macro_board = root_board;
+        u8 player = root_player;
+
+        u8 winner = descend(path, macro_board, player);
+
+        // points for the player who made the move into the last node
+        u8 points;
+        if (winner != NONE){
+            points = get_points(winner, NEXT_PLAYER(player));
+        }else if (use_alpha_beta(macro_board)){
+            points = WIN_POINTS - evaluate(alpha_beta, macro_board, player);
+        }else{
+            winner = playout(macro_board, player, rng, rave_equivalence > 0.0 ? &played : NULL);
+            points = get_points(winner, NEXT_PLAYER(player));
+        }
+
+        ATOMIC_ADD(n_playouts, 1);
+
+        backup(path, NEXT_PLAYER(player), points, played);
+    }
+
+    // Descend batch_size times before evaluating all new leaves with one
+    // call to the network. Virtual losses on the pending paths steer the
+    // descents to different leaves.
+    void iterate_batch(Array<PendingLeaf, NN_BATCH> &leaves, Array<NetworkInput, NN_BATCH> &inputs){
+        u32 n = 0;
+        for (u32 i = 0; i < batch_size && ATOMIC_LOAD(n_playouts) < max_playouts; i++){
+            PendingLeaf &leaf = leaves[n];
+            leaf.path.clear();
+            MacroBoard macro_board = root_board;
+            u8 player = root_player;
+
+            u8 winner = descend(leaf.path, macro_board, player);
+            ATOMIC_ADD(n_playouts, 1);
+            leaf.player = NEXT_PLAYER(player);
+
+            // game over, nothing to evaluate
+            if (winner != NONE){
+                Array<CellSet, 2> played;
+                backup(leaf.path, leaf.player, get_points(winner, leaf.player), played);
+                continue;
+            }
+
+            encode(macro_board, player, inputs[n]);
+            n++;
+        }
+
+        Array<float, NN_BATCH> values;
+        network->evaluate(inputs.data(), n, values.data());
+
+        for (u32 i = 0; i < n; i++){
+            // value is for the player to move at the leaf
+            u8 points = WIN_POINTS - (u8)(values[i]*WIN_POINTS + 0.5f);
+            Array<CellSet, 2> played;
+            backup(leaves[i].path, leaves[i].player, points, played);
+        }
+    }
+
+    // update every move of node which was played later by the same player
+    void update_amaf(u32 index, const CellSet &played, u8 points){
+        const MctsNode &node = nodes[index];
+        u32 first_child = __atomic_load_n(&node.first_child, __ATOMIC_ACQUIRE);
+        for (u32 i = first_child; i < first_child + node.n_children; i++){
+            MctsNode &child = nodes[i];
+            if (!played.contains(child.move)) continue;
+            ATOMIC_ADD(child.amaf_visits, 1);
+            ATOMIC_ADD(child.amaf_points, points);
+        }
+    }
+
+    // Try to prove a node where player is to move. The player wins if any
+    // move wins. Once all moves are proven, the best of them is a tie or
+    // a loss. Returns whether the node is proven.
+    bool prove(u32 index, u8 player){
+        MctsNode &node = nodes[index];
+        if (node.is_proven()) return true;
+
+        u32 first_child = __atomic_load_n(&node.first_child, __ATOMIC_ACQUIRE);
+        if (first_child >= EXPANDING) return false;
+
+        u8 opponent = NEXT_PLAYER(player);
+        u8 winner = opponent;
+        for (u32 i = first_child; i < first_child + node.n_children; i++){
+            u8 child_winner = nodes[i].get_winner();
+            if (child_winner == player){
+                winner = player;
+                break;
+            }
+            if (child_winner == NONE) return false;
+            if (child_winner == TIE) winner = TIE;
+        }
+
+        __atomic_store_n(&node.winner, winner, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    void search(Rng rng, Timer timer){
+        if (network){
+            search_batches(timer);
+            return;
+        }
+
+        // every thread needs its own board to search on
+        MacroAlphaBeta alpha_beta(rollout_depth);
+        double dt = 0.0;
+        do {
+            // timer is only checked every few playouts
+            for (int i = 0; i < 64 && ATOMIC_LOAD(n_playouts) < max_playouts; i++){
+                iterate(rng, alpha_beta);
+            }
+            dt += timer.stop();
+        } while (ATOMIC_LOAD(n_playouts) < max_playouts && dt < max_sec && !nodes[root].is_proven() && !is_full());
+    }
+
+    void search_batches(Timer timer){
+        assert(batch_size > 0 && batch_size <= NN_BATCH);
+
+        // every thread collects its own batches
+        Array<PendingLeaf, NN_BATCH> leaves;
+        Array<NetworkInput, NN_BATCH> inputs;
+        double dt = 0.0;
+        do {
+            iterate_batch(leaves, inputs);
+            dt += timer.stop();
+        } while (ATOMIC_LOAD(n_playouts) < max_playouts && dt < max_sec && !nodes[root].is_proven() && !is_full());
+    }
+
+    // whether expand would fail for lack of room
+    bool is_full() const {
+        return ATOMIC_LOAD(n_nodes) + MAX_MOVES > capacity;
+    }
+
+    // Cut the subtrees below nodes with few visits until at most half of
+    // the arena is used. Pruned nodes keep their statistics and proofs and
+    // are expanded again when the search comes back to them.
+    void recycle(){
+        if (n_nodes > capacity) n_nodes = capacity;
+        for (u32 min_visits = 2; n_nodes > capacity/2 && min_visits <= nodes[root].visits; min_visits *= 2){
+            for (u32 i = root + 1; i < n_nodes; i++){
+                MctsNode &node = nodes[i];
+                if (node.visits >= min_visits || !node.is_expanded()) continue;
+                node.first_child = NO_CHILDREN;
+                node.n_children = 0;
+            }
+            compact(root);
+        }
+    }
+
+    // Proven win if there is one, otherwise the most visited move which is
+    // not proven, unless its mean is at most the 1/2 of a proven tie. Proven
+    // losses come last, the most visited of them delays the loss the most.
+    u32 get_best_child(u32 index, u8 player){
+        const MctsNode &node = nodes[index];
+        assert(node.is_expanded());
+
+        u32 unproven = NO_CHILDREN;
+        u32 tie = NO_CHILDREN;
+        u32 loss = NO_CHILDREN;
+        for (u32 i = node.first_child; i < node.first_child + node.n_children; i++){
+            const MctsNode &child = nodes[i];
+            u8 child_winner = child.get_winner();
+            if (child_winner == player) return i;
+
+            u32 &best = child_winner == NONE ? unproven : child_winner == TIE ? tie : loss;
+            if (best == NO_CHILDREN || child.visits > nodes[best].visits) best = i;
+        }
+
+        if (unproven != NO_CHILDREN){
+            const MctsNode &child = nodes[unproven];
+            if (tie == NO_CHILDREN || 2*u64(child.points) > u64(WIN_POINTS)*child.visits) return unproven;
+        }
+        return tie != NO_CHILDREN ? tie : loss;
+    }
+
+    Move operator () (const MacroBoard &macro_board, u8 player){
+        Timer timer;
+
+        if (!reuse(macro_board, player)){
+            reset(macro_board, player);
+
+            // discard all previous moves except the last one for faster copying
+            if (!macro_board.moves.empty()){
+                auto &moves = root_board.moves;
+                Move last_move = moves.back();
+                moves.clear();
+                moves.push_back(last_move);
+            }
+        }
+
+        // The search never expands proven leaves, but a dead draw is proven
+        // before the game is over and might have become the root. The
+        // arena was just compacted, so there is room for the children.
+        if (!nodes[root].is_expanded()) expand(root, root_board, root_player);
+
+        n_playouts = 0;
+        while (true){
+            n_searches++;
+
+            run_search_threads(this, n_threads, rng, n_searches, timer);
+
+            // the threads stopped early if the arena ran full
+            Timer elapsed = timer;
+            if (!is_full() || nodes[root].is_proven()) break;
+            if (ATOMIC_LOAD(n_playouts) >= max_playouts || elapsed.stop() >= max_sec) break;
+            recycle();
+        }
+
+        u32 best_child = get_best_child(root, root_player);
+        Move move = nodes[best_child].move;
+
+        // keep the subtree of the chosen move for the next search
+        root_board.play(move, root_player);
+        root_player = NEXT_PLAYER(root_player);
+        root = best_child;
+
+        return move;
+    }
+};
@@ -0,0 +1,373 @@
+#pragma once
+
+#include "mcts.hpp"
+
+#define NO_NODE 0xffffffff
+
+// A position in the search graph, found by its hash.
+struct GraphNode {
+    u64 hash;        // 0 if slot is empty
+    u32 first_edge;  // index of first edge in edge arena, edges are contiguous
+    u32 visits;
+    u32 points;      // sum of points for the player who moved into the position
+    u8 n_edges;
+    u8 winner;       // winner with perfect play if proven, NONE otherwise
+
+    bool is_expanded() const {
+        return __atomic_load_n(&first_edge, __ATOMIC_ACQUIRE) < EXPANDING;
+    }
+
+    bool is_proven() const {
+        return get_winner() != NONE;
+    }
+
+    u8 get_winner() const {
+        return __atomic_load_n(&winner, __ATOMIC_RELAXED);
+    }
+};
+
+struct GraphEdge {
+    u32 node;
+    Move move;
+};
+
+// Monte Carlo graph search. Like Mcts, but positions which can be reached
+// by different move orders share one node and its statistics. Nodes live
+// in an open addressing hash table which threads insert into with a
+// compare-and-swap on the hash. Visits and points are backed up along the
+// path which was actually taken. Nodes stay in the table between searches,
+// so everything reachable from the new root is reused. The table is
+// cleared when it gets too full.
+struct MctsGraph {
+    GraphNode *nodes;
+    u32 capacity; // power of two
+    GraphEdge *edges;
+    u32 edge_capacity;
+    u32 n_nodes;
+    u32 n_edges;
+
+    u32 root;
+    MacroBoard root_board;
+    u8 root_player;
+
+    double max_sec;
+    u32 max_playouts;
+    double exploration;
+    Rng rng;
+    u32 n_threads;
+    u32 virtual_loss;
+    bool heavy_playouts; // playouts with simple tactics instead of random moves
+    const Tablebase *tablebase; // ends playouts early with exact results if set
+
+    u32 n_playouts;
+    u32 n_searches;
+
+    MctsGraph(
+        u32 capacity,
+        double max_sec,
+        u32 max_playouts = UINT_MAX,
+        double exploration = 1.4,
+        const Rng &rng = Rng(),
+        u32 n_threads = 1,
+        u32 virtual_loss = 1
+    ):
+        nodes(new GraphNode[capacity]),
+        capacity(capacity),
+        edges(new GraphEdge[capacity]),
+        edge_capacity(capacity),
+        root(NO_NODE),
+        root_player(NONE),
+        max_sec(max_sec),
+        max_playouts(max_playouts),
+        exploration(exploration),
+        rng(rng),
+        n_threads(n_threads),
+        virtual_loss(virtual_loss),
+        heavy_playouts(false),
+        tablebase(NULL),
+        n_playouts(0),
+        n_searches(0)
+    {
+        assert(capacity > MAX_MOVES && (capacity & (capacity - 1)) == 0);
+        assert(n_threads > 0 && n_threads <= MAX_THREADS);
+        clear();
+    }
+
+    ~MctsGraph(){
+        delete[] nodes;
+        delete[] edges;
+    }
+
+    MctsGraph(const MctsGraph&) = delete;
+    MctsGraph& operator = (const MctsGraph&) = delete;
+
+    void clear(){
+        for (u32 i = 0; i < capacity; i++){
+            nodes[i] = GraphNode{0, NO_CHILDREN, 0, 0, 0, NONE};
+        }
+        n_nodes = 0;
+        n_edges = 0;
+    }
+
+    // returns NO_NODE if the table is full
+    u32 find_or_insert(u64 hash, u8 winner){
+        // 0 marks empty slots
+        if (hash == 0) hash = 1;
+
+        u32 mask = capacity - 1;
+        for (u32 probe = 0; probe < 64; probe++){
+            u32 i = (hash + probe) & mask;
+            GraphNode &node = nodes[i];
+            u64 key = __atomic_load_n(&node.hash, __ATOMIC_RELAXED);
+            if (key == 0){
+                if (ATOMIC_LOAD(n_nodes) >= capacity/4*3) return NO_NODE;
+                if (__atomic_compare_exchange_n(&node.hash, &key, hash, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                    ATOMIC_ADD(n_nodes, 1);
+                    key = hash;
+                }
+            }
+            if (key == hash){
+                // every path into the position computes the same winner
+                if (winner != NONE) __atomic_store_n(&node.winner, winner, __ATOMIC_RELAXED);
+                return i;
+            }
+        }
+        return NO_NODE;
+    }
+
+    // Allocate one edge per legal move. Returns false if the table is full
+    // or if another thread is expanding the node already.
+    bool expand(u32 index, const MacroBoard &macro_board, u8 player){
+        if (ATOMIC_LOAD(n_edges) + MAX_MOVES > edge_capacity) return false;
+
+        GraphNode &node = nodes[index];
+        u32 expected = NO_CHILDREN;
+        if (!__atomic_compare_exchange_n(&node.first_edge, &expected, EXPANDING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            return false;
+        }
+
+        u64 hash = __atomic_load_n(&node.hash, __ATOMIC_RELAXED);
+        u8 forced_big_move = get_forced_big_move(macro_board);
+
+        SmallVector<GraphEdge, MAX_MOVES> children;
+        bool ok = for_each_search_move(macro_board, player, index == root, [&](Move move, u8 winner, const MacroBoard &board){
+            u64 child_hash = get_child_hash(hash, move, player, forced_big_move, get_forced_big_move(board));
+            u32 child = find_or_insert(child_hash, winner);
+            if (child == NO_NODE) return false;
+            children.push_back(GraphEdge{child, move});
+            return true;
+        });
+        if (!ok){
+            __atomic_store_n(&node.first_edge, NO_CHILDREN, __ATOMIC_RELEASE);
+            return false;
+        }
+
+        assert(children.size() > 0);
+
+        u32 first_edge = ATOMIC_ADD(n_edges, children.size());
+        if (first_edge + children.size() > edge_capacity){
+            __atomic_store_n(&node.first_edge, NO_CHILDREN, __ATOMIC_RELEASE);
+            return false;
+        }
+
+        for (u32 i = 0; i < children.size(); i++){
+            edges[first_edge + i] = children[i];
+        }
+        node.n_edges = children.size();
+
+        // publish edges
+        __atomic_store_n(&node.first_edge, first_edge, __ATOMIC_RELEASE);
+
+        return true;
+    }
+
+    // returns index of edge
+    u32 select(u32 index){
+        const GraphNode &node = nodes[index];
+        u32 first_edge = __atomic_load_n(&node.first_edge, __ATOMIC_ACQUIRE);
+        double log_visits = log(ATOMIC_LOAD(node.visits) + 1);
+
+        u32 best_edge = first_edge;
+        double best_value = -INF;
+
+        for (u32 i = first_edge; i < first_edge + node.n_edges; i++){
+            const GraphNode &child = nodes[edges[i].node];
+            // nothing left to learn about proven children
+            if (child.is_proven()) continue;
+
+            u32 visits = ATOMIC_LOAD(child.visits);
+            if (visits == 0) return i;
+
+            double mean = ATOMIC_LOAD(child.points)/(double)(WIN_POINTS*visits);
+            double value = mean + exploration*sqrt(log_visits/visits);
+            if (value > best_value){
+                best_value = value;
+                best_edge = i;
+            }
+        }
+
+        return best_edge;
+    }
+
+    // same rules as Mcts::prove
+    bool prove(u32 index, u8 player){
+        GraphNode &node = nodes[index];
+        if (node.is_proven()) return true;
+
+        u32 first_edge = __atomic_load_n(&node.first_edge, __ATOMIC_ACQUIRE);
+        if (first_edge >= EXPANDING) return false;
+
+        u8 opponent = NEXT_PLAYER(player);
+        u8 winner = opponent;
+        for (u32 i = first_edge; i < first_edge + node.n_edges; i++){
+            u8 child_winner = nodes[edges[i].node].get_winner();
+            if (child_winner == player){
+                winner = player;
+                break;
+            }
+            if (child_winner == NONE) return false;
+            if (child_winner == TIE) winner = TIE;
+        }
+
+        __atomic_store_n(&node.winner, winner, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    void iterate(Rng &rng){
+        SmallVector<u32, MAX_MOVES + 1> path;
+        MacroBoard macro_board = root_board;
+        u8 player = root_player;
+
+        u32 index = root;
+        path.push_back(index);
+        ATOMIC_ADD(nodes[index].visits, virtual_loss);
+
+        while (nodes[index].is_expanded() && !nodes[index].is_proven()){
+            const GraphEdge &edge = edges[select(index)];
+            index = edge.node;
+            macro_board.play(edge.move, player);
+            player = NEXT_PLAYER(player);
+            path.push_back(index);
+            ATOMIC_ADD(nodes[index].visits, virtual_loss);
+        }
+
+        u8 winner = nodes[index].get_winner();
+        bool proven = winner != NONE;
+        bool expanded = false;
+
+        if (winner == NONE){
+            // expand on second visit, root is always expanded
+            bool visited = ATOMIC_LOAD(nodes[index].visits) > virtual_loss;
+            if ((visited || index == root) && expand(index, macro_board, player)){
+                expanded = true;
+                const GraphEdge &edge = edges[select(index)];
+                index = edge.node;
+                winner = macro_board.play_or_draw(edge.move, player);
+                player = NEXT_PLAYER(player);
+                path.push_back(index);
+                ATOMIC_ADD(nodes[index].visits, virtual_loss);
+                proven = winner != NONE;
+            }
+
+            if (winner == NONE){
+                BitBoard bit_board(macro_board);
+                winner = bit_board.playout(player, rng, NULL, heavy_playouts, tablebase);
+            }
+        }
+
+        ATOMIC_ADD(n_playouts, 1);
+
+        // player who made the move into the last node
+        player = NEXT_PLAYER(player);
+
+        // a new child or proven leaf might prove its ancestors
+        if (proven || expanded){
+            u8 parent_player = player;
+            for (u32 i = path.size() - 1; i-- > 0;){
+                if (!prove(path[i], parent_player)) break;
+                parent_player = NEXT_PLAYER(parent_player);
+            }
+        }
+
+        // replace virtual losses by result
+        for (u32 i = path.size(); i-- > 0;){
+            GraphNode &node = nodes[path[i]];
+            ATOMIC_ADD(node.visits, 1 - virtual_loss);
+            ATOMIC_ADD(node.points, get_points(winner, player));
+            player = NEXT_PLAYER(player);
+        }
+    }
+
+    // like Mcts::search
+    void search(Rng rng, Timer timer){
+        double dt = 0.0;
+        do {
+            for (int i = 0; i < 64 && ATOMIC_LOAD(n_playouts) < max_playouts; i++){
+                iterate(rng);
+            }
+            dt += timer.stop();
+        } while (ATOMIC_LOAD(n_playouts) < max_playouts && dt < max_sec && !nodes[root].is_proven());
+    }
+
+    // same rules as Mcts::get_best_child, returns index of edge
+    u32 get_best_edge(u32 index, u8 player){
+        const GraphNode &node = nodes[index];
+        assert(node.is_expanded());
+
+        u32 unproven = NO_CHILDREN;
+        u32 tie = NO_CHILDREN;
+        u32 loss = NO_CHILDREN;
+        for (u32 i = node.first_edge; i < node.first_edge + node.n_edges; i++){
+            const GraphNode &child = nodes[edges[i].node];
+            u8 child_winner = child.get_winner();
+            if (child_winner == player) return i;
+
+            u32 &best = child_winner == NONE ? unproven : child_winner == TIE ? tie : loss;
+            if (best == NO_CHILDREN || child.visits > nodes[edges[best].node].visits) best = i;
+        }
+
+        if (unproven != NO_CHILDREN){
+            const GraphNode &child = nodes[edges[unproven].node];
+            if (tie == NO_CHILDREN || 2*u64(child.points) > u64(WIN_POINTS)*child.visits) return unproven;
+        }
+        return tie != NO_CHILDREN ? tie : loss;
+    }
+
+    Move operator () (const MacroBoard &macro_board, u8 player){
+        Timer timer;
+
+        // make room for this search
+        if (n_nodes > capacity/2 || n_edges > edge_capacity/2) clear();
+
+        root_board = macro_board;
+        root_player = player;
+
+        // discard all previous moves except the last one for faster copying
+        if (!macro_board.moves.empty()){
+            auto &moves = root_board.moves;
+            Move last_move = moves.back();
+            moves.clear();
+            moves.push_back(last_move);
+        }
+
+        root = find_or_insert(get_hash(root_board, player), NONE);
+        if (root == NO_NODE){
+            clear();
+            root = find_or_insert(get_hash(root_board, player), NONE);
+        }
+
+        // a proven root might not be expanded, see Mcts::operator ()
+        if (!nodes[root].is_expanded() && !expand(root, root_board, root_player)){
+            clear();
+            root = find_or_insert(get_hash(root_board, player), NONE);
+            expand(root, root_board, root_player);
+        }
+
+        n_playouts = 0;
+        n_searches++;
+
+        run_search_threads(this, n_threads, rng, n_searches, timer);
+
+        return edges[get_best_edge(root, root_player)].move;
+    }
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <math.h>
+
+#include "common.hpp"
+
+// Inputs are binary planes from the view of the player to move:
+// 81 cells of the player, 81 cells of the opponent,
+// then 9 micro boards won by the player and 9 won by the opponent.
+#define NN_INPUTS (81*2 + 9*2)
+#define NN_HIDDEN 32
+#define NN_BATCH 64
+
+// four floats, one SSE register, arithmetic works element-wise
+typedef float f32x4 __attribute__((vector_size(16)));
+
+#define NN_LANES (NN_HIDDEN/4)
+
+typedef Array<float, NN_INPUTS> NetworkInput;
+
+void encode(const MacroBoard &macro_board, u8 player, NetworkInput &input){
+    u8 opponent = NEXT_PLAYER(player);
+    for (float &x : input) x = 0.0f;
+
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        const MicroBoard &micro_board = macro_board.micro_boards[big_move];
+        for (u8 small_move = 0; small_move < 9; small_move++){
+            u8 cell = micro_board.get(small_move);
+            if (cell == player) input[big_move*9 + small_move] = 1.0f;
+            if (cell == opponent) input[81 + big_move*9 + small_move] = 1.0f;
+        }
+
+        u8 winner = macro_board.winners.get(big_move);
+        if (winner == player) input[162 + big_move] = 1.0f;
+        if (winner == opponent) input[171 + big_move] = 1.0f;
+    }
+}
+
+// Value network with one hidden ReLU layer. The output is the probability
+// that the player to move wins, counting a tie as half a win.
+// Positions are evaluated in batches so that every weight row is loaded
+// once per batch instead of once per position.
+struct Network {
+    Array<Array<f32x4, NN_LANES>, NN_INPUTS> w1;
+    Array<f32x4, NN_LANES> b1;
+    Array<f32x4, NN_LANES> w2;
+    float b2;
+
+    // small random weights until there is a trained network
+    Network(Rng &rng, float scale = 0.1f){
+        for (auto &row : w1){
+            for (f32x4 &w : row) w = random_lanes(rng, scale);
+        }
+        for (f32x4 &b : b1) b = random_lanes(rng, scale);
+        for (f32x4 &w : w2) w = random_lanes(rng, scale);
+        b2 = 0.0f;
+    }
+
+    static f32x4 random_lanes(Rng &rng, float scale){
+        f32x4 w;
+        for (int i = 0; i < 4; i++){
+            w[i] = scale*(rng()*(2.0f/4294967296.0f) - 1.0f);
+        }
+        return w;
+    }
+
+    void evaluate(const NetworkInput *inputs, u32 n, float *values) const {
+        assert(n <= NN_BATCH);
+        Array<Array<f32x4, NN_LANES>, NN_BATCH> hidden;
+
+        for (u32 b = 0; b < n; b++) hidden[b] = b1;
+
+        // inner loops index raw pointers to skip the bounds checks
+        for (u32 j = 0; j < NN_INPUTS; j++){
+            const f32x4 *row = w1[j].data();
+            for (u32 b = 0; b < n; b++){
+                // inputs are binary and mostly zero
+                if (inputs[b][j] == 0.0f) continue;
+                f32x4 *h = hidden[b].data();
+                for (u32 k = 0; k < NN_LANES; k++) h[k] += row[k];
+            }
+        }
+
+        const f32x4 zero = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (u32 b = 0; b < n; b++){
+            const f32x4 *h = hidden[b].data();
+            f32x4 sum = zero;
+            for (u32 k = 0; k < NN_LANES; k++){
+                f32x4 relu = h[k] > zero ? h[k] : zero;
+                sum += relu*w2[k];
+            }
+            float logit = b2 + sum[0] + sum[1] + sum[2] + sum[3];
+            values[b] = 1.0f/(1.0f + expf(-logit));
+        }
+    }
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNUE_X86
+#endif
+
+#include "util.hpp"
+
+// Efficiently updatable evaluation network for alpha-beta.
+// Features are binary: 81 cells of X, 81 cells of O, 9 micro boards won
+// by X and 9 won by O. A move changes one cell and maybe one micro board,
+// so the first layer is kept up to date by adding or subtracting weight
+// columns instead of being computed from scratch at every leaf.
+#define NNUE_FEATURES (81*2 + 9*2)
+#define NNUE_HIDDEN 32     // 32 int16 fill two AVX2 registers
+#define NNUE_CLIP 127      // hidden activations are clamped to [0, NNUE_CLIP]
+#define NNUE_OUTPUT_DIV 64 // output units per heuristic point
+#define NNUE_MAGIC "UTTTNNUE"
+#define NNUE_VERSION 1
+
+u32 get_cell_feature(u8 big_move, u8 small_move, u8 player){
+    return (player - 1)*81 + big_move*9 + small_move;
+}
+
+u32 get_winner_feature(u8 big_move, u8 player){
+    return 81*2 + (player - 1)*9 + big_move;
+}
+
+struct Nnue {
+    Array<Array<i16, NNUE_HIDDEN>, NNUE_FEATURES> w1;
+    Array<i16, NNUE_HIDDEN> b1;
+    Array<i8, NNUE_HIDDEN> w2;
+    i32 b2;
+
+    // small random weights until there is a trained network
+    void randomize(Rng &rng){
+        for (auto &column : w1){
+            for (i16 &w : column) w = i16(rng() % 17) - 8;
+        }
+        for (i16 &b : b1) b = i16(rng() % 17) - 8;
+        for (i8 &w : w2) w = i8(rng() % 33) - 16;
+        b2 = 0;
+    }
+
+    // File layout: magic, u32 version, then w1, b1, w2 and b2 as
+    // little-endian integers without padding.
+    bool load(const char *path){
+        FILE *f = fopen(path, "rb");
+        if (!f){
+            fprintf(stderr, "Failed to open %s\n", path);
+            return false;
+        }
+
+        char magic[8];
+        u32 version;
+        bool ok =
+            fread(magic, sizeof(magic), 1, f) == 1 &&
+            memcmp(magic, NNUE_MAGIC, sizeof(magic)) == 0 &&
+            fread(&version, sizeof(version), 1, f) == 1 &&
+            version == NNUE_VERSION &&
+            fread(w1.data(), sizeof(w1), 1, f) == 1 &&
+            fread(b1.data(), sizeof(b1), 1, f) == 1 &&
+            fread(w2.data(), sizeof(w2), 1, f) == 1 &&
+            fread(&b2, sizeof(b2), 1, f) == 1;
+        fclose(f);
+
+        if (!ok) fprintf(stderr, "Invalid network file %s\n", path);
+        return ok;
+    }
+
+    bool save(const char *path) const {
+        FILE *f = fopen(path, "wb");
+        if (!f){
+            fprintf(stderr, "Failed to open %s\n", path);
+            return false;
+        }
+
+        u32 version = NNUE_VERSION;
+        bool ok =
+            fwrite(NNUE_MAGIC, 8, 1, f) == 1 &&
+            fwrite(&version, sizeof(version), 1, f) == 1 &&
+            fwrite(w1.data(), sizeof(w1), 1, f) == 1 &&
+            fwrite(b1.data(), sizeof(b1), 1, f) == 1 &&
+            fwrite(w2.data(), sizeof(w2), 1, f) == 1 &&
+            fwrite(&b2, sizeof(b2), 1, f) == 1;
+        return fclose(f) == 0 && ok;
+    }
+};
+
+// First layer of a Nnue for the current position, updated by MacroBoard.
+// int16 arithmetic wraps, so adding and subtracting a column always
+// restores the previous values exactly.
+struct Accumulator {
+    Array<i16, NNUE_HIDDEN> values;
+    const Nnue *nnue;
+
+    Accumulator(): nnue(NULL){}
+
+    void clear(){
+        values = nnue->b1;
+    }
+
+    void add(u32 feature){
+        const i16 *w = nnue->w1[feature].data();
+        for (u32 i = 0; i < NNUE_HIDDEN; i++) values.values[i] += w[i];
+    }
+
+    void sub(u32 feature){
+        const i16 *w = nnue->w1[feature].data();
+        for (u32 i = 0; i < NNUE_HIDDEN; i++) values.values[i] -= w[i];
+    }
+
+    // score for X in heuristic points
+    int evaluate() const {
+#ifdef NNUE_X86
+        if (__builtin_cpu_supports("avx2")) return evaluate_avx2() / NNUE_OUTPUT_DIV;
+#endif
+        i32 sum = nnue->b2;
+        for (u32 i = 0; i < NNUE_HIDDEN; i++){
+            i32 h = values.values[i];
+            if (h < 0) h = 0;
+            if (h > NNUE_CLIP) h = NNUE_CLIP;
+            sum += h*nnue->w2.values[i];
+        }
+        return sum / NNUE_OUTPUT_DIV;
+    }
+
+#ifdef NNUE_X86
+    __attribute__((target("avx2")))
+    i32 evaluate_avx2() const {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i clip = _mm256_set1_epi16(NNUE_CLIP);
+        __m256i sum = zero;
+        for (u32 i = 0; i < NNUE_HIDDEN; i += 16){
+            __m256i h = _mm256_loadu_si256((const __m256i*)&values.values[i]);
+            h = _mm256_min_epi16(_mm256_max_epi16(h, zero), clip);
+            __m128i w8 = _mm_loadu_si128((const __m128i*)&nnue->w2.values[i]);
+            __m256i w = _mm256_cvtepi8_epi16(w8);
+            // multiply 16 pairs and add neighbours to 8 int32
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(h, w));
+        }
+        __m128i sum4 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        sum4 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, 0x4e));
+        sum4 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, 0xb1));
+        return nnue->b2 + _mm_cvtsi128_si32(sum4);
+    }
+#endif
+};
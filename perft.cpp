@@ -0,0 +1,285 @@
+// Counts the positions at a given depth below a position, for every move
+// at the root and in total, to check move generation and to measure it:
+//     ./perft depth [threads] [hash megabytes] [check] [cells] [forced]
+// The position is the empty board or 81 cells of X, O and - in the order
+// of from_buffer, with the forced micro board as x + 3*y or -1 for any.
+// With check, MacroBoard and BitBoard, the board of magic.c, walk the tree
+// together and the program stops at the first position where their legal
+// moves or results differ. Otherwise MacroBoard counts with can_play, play
+// and undo, then BitBoard counts on its own and the totals are compared.
+#include <thread>
+
+#include "common.hpp"
+#include "bitboard.hpp"
+#include "timer.hpp"
+
+#define MAX_PERFT_THREADS 64
+
+// legal small moves of every micro board
+typedef Array<u16, 9> MoveMasks;
+
+MoveMasks get_move_masks(const MacroBoard &macro_board){
+    MoveMasks masks;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        masks[big_move] = 0;
+        if (!macro_board.can_play_big_move(big_move)) continue;
+        for (u8 small_move = 0; small_move < 9; small_move++){
+            if (macro_board.micro_boards[big_move].can_play(small_move)) masks[big_move] |= 1 << small_move;
+        }
+    }
+    return masks;
+}
+
+MoveMasks get_move_masks(const BitBoard &bit_board){
+    MoveMasks masks;
+    u32 big_moves = bit_board.can_play_anywhere() ? bit_board.macro_moves : bit_board.macro_moves & (1 << bit_board.forced_big_move);
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        masks[big_move] = ((big_moves >> big_move) & 1) ? bit_board.micro_moves[big_move] : 0;
+    }
+    return masks;
+}
+
+u32 count_moves(const MoveMasks &masks){
+    u32 n = 0;
+    for (u16 mask : masks) n += __builtin_popcount(mask);
+    return n;
+}
+
+// Counts of positions with more than 2 plies left, shared by all threads.
+// The check word is the hash xor the count, so an entry which was torn by
+// a concurrent write does not match any hash.
+struct PerftEntry {
+    u64 check;
+    u64 count;
+};
+
+struct PerftTable {
+    PerftEntry *entries;
+    u64 mask;
+
+    PerftTable(u64 megabytes): entries(NULL), mask(0){
+        if (megabytes == 0) return;
+        u64 n = 1;
+        while (2*n*sizeof(PerftEntry) <= megabytes << 20) n *= 2;
+        entries = new PerftEntry[n]();
+        mask = n - 1;
+    }
+
+    ~PerftTable(){
+        delete[] entries;
+    }
+
+    PerftTable(const PerftTable&) = delete;
+    PerftTable& operator = (const PerftTable&) = delete;
+
+    static u64 get_key(u64 hash, int depth){
+        return hash ^ (u64(depth)*0x9e3779b97f4a7c15);
+    }
+
+    bool find(u64 hash, int depth, u64 &count) const {
+        u64 key = get_key(hash, depth);
+        const PerftEntry &entry = entries[key & mask];
+        u64 check = __atomic_load_n(&entry.check, __ATOMIC_RELAXED);
+        count = __atomic_load_n(&entry.count, __ATOMIC_RELAXED);
+        return (check ^ count) == key;
+    }
+
+    void insert(u64 hash, int depth, u64 count){
+        u64 key = get_key(hash, depth);
+        PerftEntry &entry = entries[key & mask];
+        __atomic_store_n(&entry.check, key ^ count, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry.count, count, __ATOMIC_RELAXED);
+    }
+};
+
+u64 perft(MacroBoard &macro_board, u8 player, int depth, u64 hash, PerftTable &table){
+    if (depth == 0) return 1;
+
+    MoveMasks masks = get_move_masks(macro_board);
+    // bulk counting, the last moves do not need to be played
+    if (depth == 1) return count_moves(masks);
+
+    u64 count;
+    bool use_table = table.entries && depth > 2;
+    if (use_table && table.find(hash, depth, count)) return count;
+
+    count = 0;
+    u8 forced_big_move = get_forced_big_move(macro_board);
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        for (u16 mask = masks[big_move]; mask; mask &= mask - 1){
+            u8 small_move = __builtin_ctz(mask);
+            if (macro_board.play(Move{big_move, small_move}, player) == NONE){
+                u64 child_hash = get_child_hash(hash, Move{big_move, small_move}, player, forced_big_move, get_forced_big_move(macro_board));
+                count += perft(macro_board, NEXT_PLAYER(player), depth - 1, child_hash, table);
+            }
+            macro_board.undo();
+        }
+    }
+
+    if (use_table) table.insert(hash, depth, count);
+    return count;
+}
+
+u64 perft(const BitBoard &bit_board, u8 player, int depth){
+    if (depth == 0) return 1;
+
+    MoveMasks masks = get_move_masks(bit_board);
+    if (depth == 1) return count_moves(masks);
+
+    u64 count = 0;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        for (u16 mask = masks[big_move]; mask; mask &= mask - 1){
+            BitBoard child = bit_board;
+            if (child.play(big_move, __builtin_ctz(mask), player) != NONE) continue;
+            count += perft(child, NEXT_PLAYER(player), depth - 1);
+        }
+    }
+    return count;
+}
+
+void print_difference(MacroBoard &macro_board, u8 player, const char *what){
+    printf("boards differ in %s, player %u to move, forced micro board %u:\n", what, player, get_forced_big_move(macro_board));
+    macro_board.print();
+    printf("moves:");
+    for (Move move : macro_board.moves) printf(" (%u, %u)", move.big_move, move.small_move);
+    printf("\n");
+    exit(1);
+}
+
+u64 perft_checked(MacroBoard &macro_board, const BitBoard &bit_board, u8 player, int depth){
+    if (depth == 0) return 1;
+
+    MoveMasks masks = get_move_masks(macro_board);
+    MoveMasks bit_masks = get_move_masks(bit_board);
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        if (masks[big_move] == bit_masks[big_move]) continue;
+        printf("micro board %u: MacroBoard moves %03x, BitBoard moves %03x\n", big_move, masks[big_move], bit_masks[big_move]);
+        print_difference(macro_board, player, "legal moves");
+    }
+    if (depth == 1) return count_moves(masks);
+
+    u64 count = 0;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        for (u16 mask = masks[big_move]; mask; mask &= mask - 1){
+            u8 small_move = __builtin_ctz(mask);
+            BitBoard child = bit_board;
+            u8 bit_winner = child.play(big_move, small_move, player);
+            u8 winner = macro_board.play(Move{big_move, small_move}, player);
+            if (winner != bit_winner){
+                printf("MacroBoard winner %u, BitBoard winner %u\n", winner, bit_winner);
+                print_difference(macro_board, NEXT_PLAYER(player), "winner");
+            }
+            if (winner == NONE) count += perft_checked(macro_board, child, NEXT_PLAYER(player), depth - 1);
+            macro_board.undo();
+        }
+    }
+    return count;
+}
+
+struct PerftSearch {
+    MacroBoard macro_board;
+    u8 player;
+    int depth;
+    bool check;
+    PerftTable table;
+
+    Moves root_moves;
+    Array<u64, MAX_MOVES> counts;
+    Array<u64, MAX_MOVES> bit_counts;
+    u32 next_move;
+
+    PerftSearch(const MacroBoard &macro_board, u8 player, int depth, bool check, u64 megabytes):
+        macro_board(macro_board),
+        player(player),
+        depth(depth),
+        check(check),
+        table(megabytes),
+        next_move(0)
+    {
+        MoveMasks masks = get_move_masks(macro_board);
+        for (u8 big_move = 0; big_move < 9; big_move++){
+            for (u16 mask = masks[big_move]; mask; mask &= mask - 1){
+                root_moves.push_back(Move{big_move, u8(__builtin_ctz(mask))});
+            }
+        }
+    }
+
+    // threads take root moves until none are left
+    void run(){
+        MacroBoard board = macro_board;
+        BitBoard bit_board(macro_board);
+        u64 hash = get_hash(macro_board, player);
+        u8 forced_big_move = get_forced_big_move(macro_board);
+
+        while (true){
+            u32 i = __atomic_fetch_add(&next_move, 1, __ATOMIC_RELAXED);
+            if (i >= root_moves.size()) break;
+            Move move = root_moves[i];
+            u8 opponent = NEXT_PLAYER(player);
+
+            BitBoard bit_child = bit_board;
+            u8 bit_winner = bit_child.play(move.big_move, move.small_move, player);
+            u8 winner = board.play(move, player);
+
+            if (depth == 1){
+                counts[i] = bit_counts[i] = 1;
+            }else if (check){
+                if (winner != bit_winner) print_difference(board, opponent, "winner");
+                counts[i] = winner == NONE ? perft_checked(board, bit_child, opponent, depth - 1) : 0;
+                bit_counts[i] = counts[i];
+            }else{
+                u64 child_hash = get_child_hash(hash, move, player, forced_big_move, get_forced_big_move(board));
+                counts[i] = winner == NONE ? perft(board, opponent, depth - 1, child_hash, table) : 0;
+                bit_counts[i] = bit_winner == NONE ? perft(bit_child, opponent, depth - 1) : 0;
+            }
+            board.undo();
+        }
+    }
+};
+
+int main(int argc, char **argv){
+    if (argc < 2){
+        fprintf(stderr, "Usage: %s depth [threads] [hash megabytes] [check] [cells] [forced]\n", argv[0]);
+        return 1;
+    }
+    int depth = atoi(argv[1]);
+    u32 n_threads = argc > 2 ? atoi(argv[2]) : 1;
+    u64 megabytes = argc > 3 ? atoi(argv[3]) : 0;
+    bool check = argc > 4 && atoi(argv[4]);
+    assert(depth >= 1);
+    assert(n_threads >= 1 && n_threads <= MAX_PERFT_THREADS);
+
+    init();
+
+    MacroBoard macro_board;
+    u8 player = 1;
+    if (argc > 5) macro_board = from_string(argv[5], argc > 6 ? atoi(argv[6]) : -1, player);
+
+    Timer timer;
+    PerftSearch search(macro_board, player, depth, check, megabytes);
+    Array<std::thread, MAX_PERFT_THREADS> threads;
+    for (u32 i = 0; i < n_threads; i++) threads[i] = std::thread(&PerftSearch::run, &search);
+    for (u32 i = 0; i < n_threads; i++) threads[i].join();
+    double dt = timer.stop();
+
+    u64 total = 0;
+    bool same = true;
+    for (u32 i = 0; i < search.root_moves.size(); i++){
+        Move move = search.root_moves[i];
+        printf("(%u, %u): %llu", move.big_move, move.small_move, (unsigned long long)search.counts[i]);
+        if (search.bit_counts[i] != search.counts[i]){
+            printf(", BitBoard: %llu", (unsigned long long)search.bit_counts[i]);
+            same = false;
+        }
+        printf("\n");
+        total += search.counts[i];
+    }
+    printf("depth %i: %llu positions in %f seconds, %f million per second\n",
+        depth, (unsigned long long)total, dt, total*1e-6/dt);
+
+    if (!same){
+        printf("MacroBoard and BitBoard counts differ, run with check to find the first position\n");
+        return 1;
+    }
+    return 0;
+}
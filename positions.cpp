@@ -0,0 +1,346 @@
+// Counts the distinct positions which can be reached from the empty board
+// at every ply, to size transposition tables and plan solver runs:
+//     ./positions max_ply [symmetric] [chunk megabytes] [directory]
+// With symmetric, positions which are symmetric to each other count once.
+// The positions of every ply are written to directory/ply_<ply>.bin as
+// sorted ranks of PositionRanker, 16 bytes each in native byte order.
+// Children are collected in a hash set until it holds a chunk, which is
+// then sorted and written as a run. Runs are merged into the file of the
+// next ply, so a ply may be much larger than the memory. At most
+// MERGE_FAN_IN runs are open at once, more are merged in several passes.
+#include <algorithm>
+#include <vector>
+
+#include "common.hpp"
+#include "encoding.hpp"
+#include "timer.hpp"
+
+#define EMPTY_RANK (~u128(0))
+// runs which are merged at once, each reader buffers 1 MiB
+#define MERGE_FAN_IN 64
+
+// open addressing set of ranks, cleared whenever it is written out
+struct RankSet {
+    std::vector<u128> slots;
+    u64 mask;
+    u64 size;
+    u64 max_size;
+
+    RankSet(u64 max_size): mask(0), size(0), max_size(max_size){
+        u64 n = 1;
+        // at most half full
+        while (n < 2*max_size) n *= 2;
+        slots.assign(n, EMPTY_RANK);
+        mask = n - 1;
+    }
+
+    static u64 get_hash(u128 rank){
+        u64 x = u64(rank) ^ u64(rank >> 64)*0x9e3779b97f4a7c15;
+        x ^= x >> 29;
+        x *= 0xbf58476d1ce4e5b9;
+        return x ^ (x >> 32);
+    }
+
+    void insert(u128 rank){
+        for (u64 i = get_hash(rank);; i++){
+            u128 &slot = slots[i & mask];
+            if (slot == rank) return;
+            if (slot == EMPTY_RANK){
+                slot = rank;
+                size++;
+                return;
+            }
+        }
+    }
+
+    bool is_full() const {
+        return size >= max_size;
+    }
+
+    // sorted ranks, leaves the set empty
+    std::vector<u128> take(){
+        std::vector<u128> ranks;
+        ranks.reserve(size);
+        for (u128 &slot : slots){
+            if (slot == EMPTY_RANK) continue;
+            ranks.push_back(slot);
+            slot = EMPTY_RANK;
+        }
+        size = 0;
+        std::sort(ranks.begin(), ranks.end());
+        return ranks;
+    }
+};
+
+// buffered sequential reads of a file of ranks
+struct RankReader {
+    FILE *file;
+    std::vector<u128> buffer;
+    size_t position;
+    size_t n;
+
+    RankReader(const char *path): buffer(1 << 16), position(0), n(0){
+        file = fopen(path, "rb");
+        if (!file){
+            fprintf(stderr, "Failed to open %s\n", path);
+            exit(1);
+        }
+    }
+
+    ~RankReader(){
+        fclose(file);
+    }
+
+    RankReader(const RankReader&) = delete;
+    RankReader& operator = (const RankReader&) = delete;
+
+    bool next(u128 &rank){
+        if (position == n){
+            n = fread(buffer.data(), sizeof(u128), buffer.size(), file);
+            position = 0;
+            if (n == 0) return false;
+        }
+        rank = buffer[position++];
+        return true;
+    }
+};
+
+// buffered sequential writes of a file of ranks, exits on any error
+struct RankWriter {
+    FILE *file;
+    const char *path;
+    std::vector<u128> buffer;
+
+    RankWriter(const char *path): path(path){
+        buffer.reserve(1 << 16);
+        file = fopen(path, "wb");
+        if (!file) fail();
+    }
+
+    RankWriter(const RankWriter&) = delete;
+    RankWriter& operator = (const RankWriter&) = delete;
+
+    void fail() const {
+        fprintf(stderr, "Failed to write %s\n", path);
+        exit(1);
+    }
+
+    void flush(){
+        if (fwrite(buffer.data(), sizeof(u128), buffer.size(), file) != buffer.size()) fail();
+        buffer.clear();
+    }
+
+    void push(u128 rank){
+        buffer.push_back(rank);
+        if (buffer.size() == buffer.capacity()) flush();
+    }
+
+    void close(){
+        flush();
+        if (fclose(file) != 0) fail();
+    }
+};
+
+void write_ranks(const char *path, const std::vector<u128> &ranks){
+    FILE *file = fopen(path, "wb");
+    if (!file || fwrite(ranks.data(), sizeof(u128), ranks.size(), file) != ranks.size() || fclose(file) != 0){
+        fprintf(stderr, "Failed to write %s\n", path);
+        exit(1);
+    }
+}
+
+struct PlyStats {
+    u64 n_positions;
+    u64 n_terminal;
+    u64 n_moves;       // from the positions which are not terminal
+    u32 min_moves;
+    u32 max_moves;
+};
+
+struct PositionCounter {
+    PositionRanker *ranker;
+    bool symmetric;
+    const char *directory;
+    RankSet children;
+    u32 first_run; // runs before it are merged already
+    u32 n_runs;
+
+    PositionCounter(bool symmetric, u64 chunk_size, const char *directory):
+        ranker(new PositionRanker()),
+        symmetric(symmetric),
+        directory(directory),
+        children(chunk_size),
+        first_run(0),
+        n_runs(0)
+    {}
+
+    ~PositionCounter(){
+        delete ranker;
+    }
+
+    PositionCounter(const PositionCounter&) = delete;
+    PositionCounter& operator = (const PositionCounter&) = delete;
+
+    void get_ply_path(char *path, int ply) const {
+        sprintf(path, "%s/ply_%i.bin", directory, ply);
+    }
+
+    void get_run_path(char *path, u32 run) const {
+        sprintf(path, "%s/run_%u.bin", directory, run);
+    }
+
+    u128 get_rank(const MacroBoard &macro_board, u8 player) const {
+        if (!symmetric) return ranker->rank(to_position(macro_board, player));
+        MacroBoard canonical = transform(macro_board, get_canonical_symmetry(macro_board));
+        return ranker->rank(to_position(canonical, player));
+    }
+
+    void write_run(){
+        char path[4096];
+        get_run_path(path, n_runs++);
+        write_ranks(path, children.take());
+    }
+
+    // Returns the statistics of ply and, if add_children is set, adds the
+    // children of every position in the file of ply to the runs.
+    PlyStats expand(int ply, bool add_children){
+        PlyStats stats = {0, 0, 0, MAX_MOVES, 0};
+        char path[4096];
+        get_ply_path(path, ply);
+        RankReader reader(path);
+
+        u128 rank;
+        while (reader.next(rank)){
+            stats.n_positions++;
+            Position position = ranker->unrank(rank);
+            MacroBoard macro_board = to_macro_board(position);
+
+            MicroBoard winners = macro_board.winners;
+            if (winners.update() != NONE){
+                stats.n_terminal++;
+                continue;
+            }
+
+            u32 n_moves = 0;
+            for (u8 big_move = 0; big_move < 9; big_move++){
+                if (!macro_board.can_play_big_move(big_move)) continue;
+                u16 free_cells = macro_board.micro_boards[big_move].get_free_cells();
+                if (!add_children){
+                    n_moves += __builtin_popcount(free_cells);
+                    continue;
+                }
+                for (; free_cells; free_cells &= free_cells - 1){
+                    macro_board.play(Move{big_move, u8(__builtin_ctz(free_cells))}, position.player);
+                    children.insert(get_rank(macro_board, NEXT_PLAYER(position.player)));
+                    macro_board.undo();
+                    n_moves++;
+                    if (children.is_full()) write_run();
+                }
+            }
+            stats.n_moves += n_moves;
+            stats.min_moves = std::min(stats.min_moves, n_moves);
+            stats.max_moves = std::max(stats.max_moves, n_moves);
+        }
+
+        return stats;
+    }
+
+    // k-way merge of the runs from begin to end into path, without
+    // duplicates, and removes them
+    void merge_runs(u32 begin, u32 end, const char *path){
+        std::vector<RankReader*> readers;
+        std::vector<u128> heads;
+        char run_path[4096];
+        for (u32 run = begin; run < end; run++){
+            get_run_path(run_path, run);
+            readers.push_back(new RankReader(run_path));
+            heads.push_back(EMPTY_RANK);
+            if (!readers.back()->next(heads.back())) heads.back() = EMPTY_RANK;
+        }
+
+        RankWriter writer(path);
+        u128 last = EMPTY_RANK;
+        while (true){
+            // runs are few, so a linear scan is cheap next to the disk
+            u32 best = 0;
+            for (u32 i = 1; i < readers.size(); i++){
+                if (heads[i] < heads[best]) best = i;
+            }
+            u128 rank = heads[best];
+            if (rank == EMPTY_RANK) break;
+            if (!readers[best]->next(heads[best])) heads[best] = EMPTY_RANK;
+
+            if (rank == last) continue;
+            last = rank;
+            writer.push(rank);
+        }
+        writer.close();
+
+        for (u32 run = begin; run < end; run++){
+            delete readers[run - begin];
+            get_run_path(run_path, run);
+            remove(run_path);
+        }
+    }
+
+    // merges the runs into the file of ply, MERGE_FAN_IN at a time into new
+    // runs until the rest fits into one merge
+    void merge(int ply){
+        if (children.size > 0 || n_runs == 0) write_run();
+
+        char path[4096];
+        while (n_runs - first_run > MERGE_FAN_IN){
+            get_run_path(path, n_runs);
+            merge_runs(first_run, first_run + MERGE_FAN_IN, path);
+            first_run += MERGE_FAN_IN;
+            n_runs++;
+        }
+        get_ply_path(path, ply);
+        merge_runs(first_run, n_runs, path);
+        first_run = 0;
+        n_runs = 0;
+    }
+};
+
+int main(int argc, char **argv){
+    if (argc < 2){
+        fprintf(stderr, "Usage: %s max_ply [symmetric] [chunk megabytes] [directory]\n", argv[0]);
+        return 1;
+    }
+    int max_ply = atoi(argv[1]);
+    bool symmetric = argc > 2 && atoi(argv[2]);
+    u64 megabytes = argc > 3 ? atoi(argv[3]) : 256;
+    const char *directory = argc > 4 ? argv[4] : ".";
+    assert(max_ply >= 0 && max_ply <= MAX_MOVES);
+
+    init();
+
+    // the hash set is at most half full, 32 bytes per rank
+    PositionCounter counter(symmetric, (megabytes << 20)/32, directory);
+
+    std::vector<u128> root = {counter.get_rank(MacroBoard(), 1)};
+    char path[4096];
+    counter.get_ply_path(path, 0);
+    write_ranks(path, root);
+
+    printf("ply  positions  terminal  moves  branching  min  max  seconds\n");
+    for (int ply = 0;; ply++){
+        Timer timer;
+        PlyStats stats = counter.expand(ply, ply < max_ply);
+        if (ply < max_ply) counter.merge(ply + 1);
+        u64 n_expanded = stats.n_positions - stats.n_terminal;
+        printf("%3i %10llu %9llu %10llu %10.3f %4u %4u %8.3f\n",
+            ply,
+            (unsigned long long)stats.n_positions,
+            (unsigned long long)stats.n_terminal,
+            (unsigned long long)stats.n_moves,
+            n_expanded ? double(stats.n_moves)/n_expanded : 0.0,
+            n_expanded ? stats.min_moves : 0,
+            stats.max_moves,
+            timer.stop());
+        fflush(stdout);
+        if (ply == max_ply || n_expanded == 0) break;
+    }
+
+    return 0;
+}
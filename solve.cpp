@@ -0,0 +1,35 @@
+// Solves a position with depth-first proof-number search:
+//     ./solve cells [forced] [table megabytes] [max million nodes]
+// The position is given like for perft, by 81 cells of X, O and - and the
+// forced micro board as x + 3*y or -1 for any. Prints the winner with
+// perfect play and a move which achieves it. The empty board is out of
+// reach, so there is no default position.
+#include "common.hpp"
+#include "dfpn.hpp"
+#include "timer.hpp"
+
+int main(int argc, char **argv){
+    if (argc < 2){
+        fprintf(stderr, "Usage: %s cells [forced] [table megabytes] [max million nodes]\n", argv[0]);
+        return 1;
+    }
+
+    init();
+
+    u8 player = 1;
+    MacroBoard macro_board = from_string(argv[1], argc > 2 ? atoi(argv[2]) : -1, player);
+    u64 megabytes = argc > 3 ? atoi(argv[3]) : 1024;
+    u64 max_nodes = argc > 4 ? atoll(argv[4])*1000000 : UINT64_MAX;
+
+    DfpnSolver solver(megabytes, max_nodes);
+    Timer timer;
+    Move move;
+    u8 winner = solver.solve(macro_board, player, move);
+    double dt = timer.stop();
+
+    const char *results[] = {"unknown, out of nodes", "X wins", "O wins", "tie"};
+    printf("%s to move: %s\n", player == 1 ? "X" : "O", results[winner]);
+    if (winner != NONE && move.big_move != DFPN_NO_MOVE.big_move) printf("move: (%u, %u)\n", move.big_move, move.small_move);
+    printf("%llu nodes in %f seconds\n", (unsigned long long)solver.n_nodes, dt);
+    return 0;
+}
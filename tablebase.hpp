@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "common.hpp"
+#include "bitboard.hpp"
+
+// Endgame tablebase of the positions where at most max_cells cells are
+// free in the undecided micro boards, written by gen_tablebase.cpp.
+// Positions which only differ in cells that can not matter anymore
+// share one entry, see get_signature. The file is a header and the
+// sorted entries key << 8 | value, it is memory-mapped (read into memory
+// on Windows) and searched by bisection. With 3 cells there would be more than 300 million entries,
+// so keys are only laid out for 2 open micro boards.
+#define TABLEBASE_MAGIC "UTTTBASE"
+#define TABLEBASE_VERSION 1
+#define TABLEBASE_MAX_CELLS 2
+
+// every TABLEBASE_BLOCK-th key is kept in memory, so only one block of
+// the file is searched
+#define TABLEBASE_BLOCK 64
+
+// value of an entry for the player to move, with the number of plies
+// until the game ends with perfect play
+#define TB_LOSS 0
+#define TB_TIE  1
+#define TB_WIN  2
+#define TB_RESULT(value) ((value) & 3)
+#define TB_DISTANCE(value) ((value) >> 2)
+
+struct TablebaseHeader {
+    char magic[8];
+    u32 version;
+    u32 max_cells;
+    u64 n_entries;
+};
+
+// What the rest of the game can depend on in a 3x3 board: the free cells,
+// whether a player has a line already, and for every line through the
+// free cells whether X or O can still complete it. Lines with only one
+// free cell are merged per cell, since it does not matter which of them
+// is completed. Used for micro boards and for the winners board, where
+// ties are in neither x_cells nor o_cells.
+u64 get_signature(u16 free_cells, u16 x_cells, u16 o_cells){
+    u64 signature = free_cells;
+    signature |= u64(contains_line[x_cells]) << 43 | u64(contains_line[o_cells]) << 44;
+    for (u8 i = 0; i < 8; i++){
+        const ThreeMoves &moves = wins[i];
+        u16 line = (1 << moves[0]) | (1 << moves[1]) | (1 << moves[2]);
+        u16 free_part = line & free_cells;
+        if (!free_part) continue;
+        u16 taken = line & ~free_cells;
+        u64 flags = ((taken & ~x_cells) == 0) | ((taken & ~o_cells) == 0) << 1;
+        if (free_part & (free_part - 1)) signature |= flags << (9 + 2*i);
+        else signature |= flags << (25 + 2*__builtin_ctz(free_part));
+    }
+    return signature;
+}
+
+struct Tablebase {
+    // smallest micro board index and winners fields with the same signature
+    Array<u16, N_MICRO_BOARDS> micro_classes;
+    u32 *macro_classes;
+
+    u32 max_cells;
+    const u64 *entries;
+    u64 n_entries;
+    std::vector<u64> block_keys; // first key of every block
+    void *mapping;
+    size_t mapping_size;
+
+    Tablebase(): macro_classes(new u32[1 << 18]), max_cells(0), entries(NULL), n_entries(0), mapping(NULL), mapping_size(0){
+        std::vector<u64> signatures(N_MICRO_BOARDS);
+        for (u32 i = 0; i < N_MICRO_BOARDS; i++){
+            MicroBoard micro_board = MicroBoard::from_index(i);
+            Array<u16, 3> cells = {0, 0, 0};
+            for (u8 move = 0; move < 9; move++) cells[micro_board.get(move)] |= 1 << move;
+            signatures[i] = get_signature(cells[NONE], cells[1], cells[2]);
+        }
+        group(signatures, micro_classes.data());
+
+        signatures.resize(1 << 18);
+        for (u32 fields = 0; fields < (1 << 18); fields++){
+            Array<u16, 4> cells = {0, 0, 0, 0};
+            for (u8 move = 0; move < 9; move++) cells[(fields >> 2*move) & 3] |= 1 << move;
+            signatures[fields] = get_signature(cells[NONE], cells[1], cells[2]);
+        }
+        group(signatures, macro_classes);
+    }
+
+    ~Tablebase(){
+        unmap();
+        delete[] macro_classes;
+    }
+
+    Tablebase(const Tablebase&) = delete;
+    Tablebase& operator = (const Tablebase&) = delete;
+
+    // classes[i] = smallest j with the same signature as i
+    template <typename T>
+    static void group(const std::vector<u64> &signatures, T *classes){
+        std::vector<std::pair<u64, u32> > sorted(signatures.size());
+        for (u32 i = 0; i < signatures.size(); i++) sorted[i] = std::make_pair(signatures[i], i);
+        std::sort(sorted.begin(), sorted.end());
+        u32 first = 0;
+        for (u32 i = 0; i < sorted.size(); i++){
+            if (i == 0 || sorted[i].first != sorted[i - 1].first) first = sorted[i].second;
+            classes[sorted[i].second] = first;
+        }
+    }
+
+    void unmap(){
+        if (!mapping) return;
+#ifdef _WIN32
+        free(mapping);
+#else
+        munmap(mapping, mapping_size);
+#endif
+        mapping = NULL;
+    }
+
+    bool load(const char *path){
+#ifdef _WIN32
+        FILE *file = fopen(path, "rb");
+        if (!file){
+            fprintf(stderr, "Failed to open %s\n", path);
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (size >= long(sizeof(TablebaseHeader))){
+            mapping_size = size;
+            mapping = malloc(mapping_size);
+            if (mapping && fread(mapping, 1, mapping_size, file) != mapping_size) unmap();
+        }
+        fclose(file);
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0){
+            fprintf(stderr, "Failed to open %s\n", path);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(TablebaseHeader)){
+            mapping_size = st.st_size;
+            mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED) mapping = NULL;
+        }
+        close(fd);
+#endif
+
+        const TablebaseHeader *header = (const TablebaseHeader*)mapping;
+        bool ok = mapping &&
+            memcmp(header->magic, TABLEBASE_MAGIC, sizeof(header->magic)) == 0 &&
+            header->version == TABLEBASE_VERSION &&
+            header->max_cells <= TABLEBASE_MAX_CELLS &&
+            mapping_size == sizeof(TablebaseHeader) + header->n_entries*sizeof(u64);
+        if (!ok){
+            fprintf(stderr, "Invalid tablebase file %s\n", path);
+            unmap();
+            return false;
+        }
+
+        max_cells = header->max_cells;
+        set_entries((const u64*)(header + 1), header->n_entries);
+        return true;
+    }
+
+    void set_entries(const u64 *entries, u64 n_entries){
+        this->entries = entries;
+        this->n_entries = n_entries;
+        block_keys.clear();
+        for (u64 i = 0; i < n_entries; i += TABLEBASE_BLOCK) block_keys.push_back(entries[i] >> 8);
+    }
+
+    // open_indices are the micro boards which are not decided, in order
+    u64 get_key(u32 winners_fields, u8 forced_big_move, u8 player, const u16 *open_indices) const {
+        u64 key = macro_classes[winners_fields] | forced_big_move << 18 | (player - 1) << 22;
+        u32 shift = 23;
+        for (u8 big_move = 0; big_move < 9; big_move++){
+            if ((winners_fields >> 2*big_move) & 3) continue;
+            key |= u64(micro_classes[*open_indices++]) << shift;
+            shift += 15;
+        }
+        return key;
+    }
+
+    bool find(u64 key, u8 &value) const {
+        // block of the last first key which is not larger than key
+        u64 block = std::upper_bound(block_keys.begin(), block_keys.end(), key) - block_keys.begin();
+        if (block == 0) return false;
+        u64 lo = (block - 1)*TABLEBASE_BLOCK;
+        u64 hi = std::min(lo + TABLEBASE_BLOCK, n_entries);
+        while (lo < hi){
+            u64 mid = (lo + hi)/2;
+            u64 mid_key = entries[mid] >> 8;
+            if (mid_key == key){
+                value = entries[mid] & 255;
+                return true;
+            }
+            if (mid_key < key) lo = mid + 1;
+            else hi = mid;
+        }
+        return false;
+    }
+
+    // value for player if the game is not over and few enough cells are left
+    bool probe(const MacroBoard &macro_board, u8 player, u8 &value) const {
+        if (u32(__builtin_popcount(~macro_board.winners.get_occupied_cells() & 511)) > max_cells) return false;
+        Array<u16, 9> open_indices;
+        u32 n_open = 0;
+        u32 n_cells = 0;
+        for (u8 big_move = 0; big_move < 9; big_move++){
+            if (macro_board.winners.get(big_move) != NONE) continue;
+            const MicroBoard &micro_board = macro_board.micro_boards[big_move];
+            n_cells += micro_board.n_moves;
+            if (n_cells > max_cells) return false;
+            open_indices[n_open++] = micro_board.index;
+        }
+        u64 key = get_key(macro_board.winners.fields, get_forced_big_move(macro_board), player, open_indices.data());
+        return find(key, value);
+    }
+};
+
+// Sets winner to the result with perfect play if tablebase has the
+// position. Only counts the free cells unless few are left.
+bool probe(const BitBoard &bit_board, const Tablebase &tablebase, u8 player, u8 &winner){
+    u32 macro_moves = bit_board.macro_moves;
+    if (u32(__builtin_popcount(macro_moves)) > tablebase.max_cells) return false;
+    u32 n_cells = 0;
+    for (u32 boards = macro_moves; boards; boards &= boards - 1){
+        n_cells += __builtin_popcount(bit_board.micro_moves[__builtin_ctz(boards)]);
+    }
+    if (n_cells > tablebase.max_cells) return false;
+
+    u32 winners_fields = 0;
+    Array<u16, 9> open_indices;
+    u32 n_open = 0;
+    for (u8 big_move = 0; big_move < 9; big_move++){
+        if ((macro_moves >> big_move) & 1){
+            u16 index = 0;
+            for (u8 small_move = 0; small_move < 9; small_move++){
+                if ((bit_board.cells[0][big_move] >> small_move) & 1) index += powers_of_three[small_move];
+                if ((bit_board.cells[1][big_move] >> small_move) & 1) index += 2*powers_of_three[small_move];
+            }
+            open_indices[n_open++] = index;
+            continue;
+        }
+        u32 winner = contains_line[bit_board.cells[0][big_move]] ? 1 : contains_line[bit_board.cells[1][big_move]] ? 2 : TIE;
+        winners_fields |= winner << 2*big_move;
+    }
+
+    u8 forced_big_move = bit_board.can_play_anywhere() ? 9 : bit_board.forced_big_move;
+    u8 value;
+    if (!tablebase.find(tablebase.get_key(winners_fields, forced_big_move, player, open_indices.data()), value)) return false;
+    winner = TB_RESULT(value) == TB_WIN ? player : TB_RESULT(value) == TB_LOSS ? NEXT_PLAYER(player) : TIE;
+    return true;
+}
+
+#ifdef USE_TABLEBASE_PROBE
+// score of MacroAlphaBeta for player
+bool probe_tablebase(const Tablebase &tablebase, const MacroBoard &macro_board, u8 player, int &score){
+    u8 value;
+    if (!tablebase.probe(macro_board, player, value)) return false;
+    score = TB_RESULT(value) == TB_WIN ? +MAX_SCORE : TB_RESULT(value) == TB_LOSS ? -MAX_SCORE : 0;
+    return true;
+}
+#endif
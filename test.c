@@ -45,7 +45,7 @@ int main(){
     struct board board[1];
     board_init2(board, c, INVALID_MOVE, 1);
     board_print(board);
-    play(board, 0.25);
+    play(board, 0.25, DEFAULT_SEED);
 
     return 0;
 }
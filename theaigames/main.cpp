@@ -14,6 +14,7 @@
 
 typedef uint8_t u8;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 // like std::array, but operator[] is bounds-checked
 template <typename T, u32 N>
@@ -75,25 +76,60 @@ struct SmallVector {
     }
 };
 
-u32 rd(){
-    static u32 x = 0x12345678;
-    x ^= x << 13;
-    x ^= x >> 17;
-    x ^= x << 5;
+#define DEFAULT_SEED 0x12345678
+
+// splitmix64 finalizer
+u64 mix64(u64 x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
     return x;
 }
 
+// copy of the counter-based Rng of util.hpp
+struct Rng {
+    u64 key;
+    u64 counter;
+
+    Rng(u64 seed = DEFAULT_SEED, u64 stream = 0):
+        key(mix64(mix64(seed) + stream)),
+        counter(0)
+    {}
+
+    Rng fork(u64 stream) const {
+        return Rng(key, stream);
+    }
+
+    u32 operator () (){
+        return mix64(key + 0x9e3779b97f4a7c15ull*++counter) >> 32;
+    }
+};
+
+// default stream for single-threaded code
+Rng default_rng;
+
+u32 rd(){
+    return default_rng();
+}
+
 template <typename ITERATOR>
-void shuffle(ITERATOR a, ITERATOR b){
+void shuffle(ITERATOR a, ITERATOR b, Rng &rng){
     u32 n = b - a;
     for (u32 i = 0; i < n - 1; i++){
-        u32 j = rd() % (n - i);
+        u32 j = i + rng() % (n - i);
         auto tmp = a[i];
         a[i] = a[j];
         a[j] = tmp;
     }
 }
 
+template <typename ITERATOR>
+void shuffle(ITERATOR a, ITERATOR b){
+    shuffle(a, b, default_rng);
+}
+
 
 
 
@@ -562,15 +598,31 @@ MacroBoard from_ints(const int *values, int x0, int y0){
 }
 
 void init(){
-    MicroBoard micro_board;
+    // same results as update() and heuristic(), but from bit masks
     for (u32 i = 0; i < (1 << 18); i++){
-        micro_board.fields = i;
 #ifdef USE_WINNER_LOOOKUP_TABLE
-        micro_board_winner[i] = micro_board.update();
+        // one bit per cell at the even positions
+        u32 x_cells = i & ~(i >> 1) & 0x15555;
+        u32 o_cells = (i >> 1) & ~i & 0x15555;
+        u32 taken = (i | (i >> 1)) & 0x15555;
+        bool x_wins = false;
+        bool o_wins = false;
+        for (ThreeMoves moves : wins){
+            u32 line = (1 << 2*moves[0]) | (1 << 2*moves[1]) | (1 << 2*moves[2]);
+            x_wins |= (x_cells & line) == line;
+            o_wins |= (o_cells & line) == line;
+        }
+        micro_board_winner[i] = o_wins ? 2 : x_wins ? 1 : taken == 0x15555 ? TIE : NONE;
 #endif
 
 #ifdef USE_HEURISTIC_LOOKUP_TABLE
-        micro_board_score[i] = micro_board.heuristic(default_weights);
+        // one term per cell, added to the state without the lowest used cell
+        if (i > 0){
+            u8 move = __builtin_ctz(i)/2;
+            u8 player = (i >> 2*move) & 3;
+            int term = player == 1 ? default_weights[move] : player == 2 ? -default_weights[move] : 0;
+            micro_board_score[i] = micro_board_score[i & ~(u32(3) << 2*move)] + term;
+        }
 #endif
     }
 }
@@ -20,6 +20,10 @@ typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
+typedef int8_t i8;
+typedef int16_t i16;
+typedef int32_t i32;
+typedef unsigned __int128 u128;
 
 #define SIZE_TYPE u32
 // like std::array, but operator[] is bounds-checked
@@ -82,23 +86,65 @@ struct SmallVector {
     }
 };
 
-u32 rd(){
-    static u32 x = 0x12345678;
-    x ^= x << 13;
-    x ^= x >> 17;
-    x ^= x << 5;
+#define DEFAULT_SEED 0x12345678
+
+// splitmix64 finalizer
+u64 mix64(u64 x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
     return x;
 }
 
+// Counter-based random number generator. The i-th number of a stream only
+// depends on (seed, stream, i), so every game or thread can get its own
+// stream and parallel runs reproduce exactly regardless of scheduling.
+struct Rng {
+    u64 key;
+    u64 counter;
+
+    Rng(u64 seed = DEFAULT_SEED, u64 stream = 0):
+        key(mix64(mix64(seed) + stream)),
+        counter(0)
+    {}
+
+    // independent sub-stream, e.g. one per game of a thread
+    Rng fork(u64 stream) const {
+        return Rng(key, stream);
+    }
+
+    u32 operator () (){
+        return mix64(key + 0x9e3779b97f4a7c15ull*++counter) >> 32;
+    }
+
+    u64 next_u64(){
+        u64 high = (*this)();
+        return (high << 32) | (*this)();
+    }
+};
+
+// default stream for single-threaded code
+Rng default_rng;
+
+u32 rd(){
+    return default_rng();
+}
+
 template <typename ITERATOR>
-void shuffle(ITERATOR a, ITERATOR b){
+void shuffle(ITERATOR a, ITERATOR b, Rng &rng){
     u32 n = b - a;
     for (u32 i = 0; i < n - 1; i++){
-        u32 j = rd() % (n - i);
+        u32 j = i + rng() % (n - i);
         auto tmp = a[i];
         a[i] = a[j];
         a[j] = tmp;
     }
 }
 
+template <typename ITERATOR>
+void shuffle(ITERATOR a, ITERATOR b){
+    shuffle(a, b, default_rng);
+}
 